@@ -0,0 +1,582 @@
+/**
+ * @file cgBatch.c
+ * @brief Implementation of the batch conversion functions.
+ */
+
+
+#include <glob.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "cgBatch.h"
+#include "cgFilter.h"
+#include "cgJobs.h"
+#include "cgMesh.h"
+#include "cgMeshCache.h"
+#include "cgPool.h"
+#include "cgTiledImage.h"
+
+
+typedef struct cg_batch
+{
+    const cgBatchOptions *opt;
+    char keyOptions[1024];
+    volatile size_t inflight;
+
+} cgBatch;
+
+typedef struct cg_batch_item
+{
+    cgBatch *batch;
+    const char *input;
+    char *stem;
+    size_t estimate;
+
+    int ok;
+    int height;
+    int width;
+    int min;
+    int max;
+    double mean;
+    double ms;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+
+} cgBatchItem;
+
+
+static double Now(
+    void
+)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t FileSize(
+    const char *fname
+)
+{
+    struct stat st;
+
+    return (stat(fname, &st) == 0) ? (uint64_t) st.st_size : 0;
+}
+
+static int AppendInput(
+    char ***list,
+    int *count,
+    int *capacity,
+    const char *name
+)
+{
+    if (*count == *capacity)
+    {
+        int grown = (*capacity > 0) ? 2 * *capacity : 64;
+        char **p = (char**) realloc(*list, grown * sizeof(char*));
+        if (p == NULL)
+            return CG_FALSE;
+        *list = p;
+        *capacity = grown;
+    }
+
+    if (((*list)[*count] = strdup(name)) == NULL)
+        return CG_FALSE;
+    (*count)++;
+
+    return CG_TRUE;
+}
+
+char **cgExpandBatchInputs(
+    char **args,
+    int count,
+    int *total
+)
+{
+    char **list = NULL;
+    char str[PATH_MAX + 32];
+    int n = 0, capacity = 0, ok = CG_TRUE;
+    int i;
+    size_t k;
+
+    for (i = 0; ok && i < count; i++)
+    {
+        /* List file: one name per line. */
+        if (args[i][0] == '@')
+        {
+            char *line = NULL;
+            size_t size = 0;
+            ssize_t len;
+
+            FILE *fp = fopen(args[i] + 1, "r");
+            if (fp == NULL)
+            {
+                snprintf(str, sizeof(str), "Unable to open file %s", args[i] + 1);
+                cgError("cgExpandBatchInputs", str);
+                ok = CG_FALSE;
+                break;
+            }
+
+            while (ok && (len = getline(&line, &size, fp)) >= 0)
+            {
+                while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+                    line[--len] = '\0';
+                if (len > 0)
+                    ok = AppendInput(&list, &n, &capacity, line);
+            }
+
+            free(line);
+            fclose(fp);
+        }
+        /* Glob. */
+        else if (strpbrk(args[i], "*?[") != NULL)
+        {
+            glob_t g;
+
+            if (glob(args[i], 0, NULL, &g) != 0)
+            {
+                snprintf(str, sizeof(str), "No files match %s", args[i]);
+                cgError("cgExpandBatchInputs", str);
+                continue;
+            }
+
+            for (k = 0; ok && k < g.gl_pathc; k++)
+                ok = AppendInput(&list, &n, &capacity, g.gl_pathv[k]);
+
+            globfree(&g);
+        }
+        else
+        {
+            ok = AppendInput(&list, &n, &capacity, args[i]);
+        }
+    }
+
+    if (!ok)
+    {
+        cgFreeBatchInputs(list, n);
+        return NULL;
+    }
+
+    *total = n;
+
+    return list;
+}
+
+void cgFreeBatchInputs(
+    char **inputs,
+    int count
+)
+{
+    int i;
+
+    if (inputs == NULL)
+        return;
+
+    for (i = 0; i < count; i++)
+        free(inputs[i]);
+    free(inputs);
+}
+
+/* Upper bound of the memory a file takes while in flight: the raster read
+ * at once, the image, a filter copy and the mesh. */
+static size_t EstimateBytes(
+    const char *fname,
+    const cgBatchOptions *opt
+)
+{
+    size_t pixels = 0;
+    size_t perPixel = 2 * sizeof(int);
+    int nr, nc, mv, type;
+
+    if (cgIsTiledImage(fname))
+    {
+        cgTiledImage tim = cgOpenTiledImage(fname);
+        if (tim != NULL)
+        {
+            pixels = (size_t) tim->height * tim->width;
+            cgCloseTiledImage(tim);
+        }
+    }
+    else
+    {
+        FILE *fp = fopen(fname, "r");
+        if (fp != NULL)
+        {
+            if (ParsePGMHeader(fp, &nr, &nc, &mv, &type) == CG_TRUE && nr > 0 && nc > 0)
+                pixels = (size_t) nr * nc;
+            fclose(fp);
+        }
+    }
+
+    if (opt->format == CG_MESH_FORMAT_HEIGHT)
+        perPixel += sizeof(cgHeightVertex) + 6 * sizeof(uint32_t);
+    else
+        perPixel += CG_MESH_FLAT_VERTICES * sizeof(cgFlatVertex);
+
+    return FileSize(fname) + pixels * perPixel;
+}
+
+/* Output names: the input name without directory and extension. */
+static char *OutputStem(
+    const char *outDir,
+    const char *input,
+    int suffix
+)
+{
+    const char *base = strrchr(input, '/');
+    const char *dot;
+    size_t len;
+    char *stem;
+
+    base = (base != NULL) ? base + 1 : input;
+    dot = strrchr(base, '.');
+    len = (dot != NULL && dot != base) ? (size_t) (dot - base) : strlen(base);
+
+    stem = (char*) malloc(strlen(outDir) + len + 32);
+    if (stem == NULL)
+        return NULL;
+
+    if (suffix > 0)
+        sprintf(stem, "%s/%.*s-%d", outDir, (int) len, base, suffix);
+    else
+        sprintf(stem, "%s/%.*s", outDir, (int) len, base);
+
+    return stem;
+}
+
+static cgBatchItem *sortItems;
+
+static int CompareStems(
+    const void *a,
+    const void *b
+)
+{
+    int i = *(const int*) a;
+    int j = *(const int*) b;
+    int d = strcmp(sortItems[i].stem, sortItems[j].stem);
+
+    return (d != 0) ? d : i - j;
+}
+
+/* Repeated names (same file name in different directories) get suffixes
+ * so no two tasks write the same output. */
+static int UniqueStems(
+    cgBatchItem *items,
+    int count,
+    const char *outDir
+)
+{
+    cgArena scratch = cgScratchArena();
+    size_t mark = (scratch != NULL) ? cgArenaMark(scratch) : 0;
+    int *order = (scratch != NULL) ? (int*) cgArenaAlloc(scratch, (count > 0 ? count : 1) * sizeof(int)) : NULL;
+    int i, k, run;
+
+    if (order == NULL)
+        return CG_FALSE;
+
+    for (i = 0; i < count; i++)
+        order[i] = i;
+
+    sortItems = items;
+    qsort(order, count, sizeof(int), CompareStems);
+
+    for (i = 0; i < count; i = k)
+    {
+        for (k = i + 1, run = 1; k < count && strcmp(items[order[k]].stem, items[order[i]].stem) == 0; k++, run++)
+        {
+            free(items[order[k]].stem);
+            if ((items[order[k]].stem = OutputStem(outDir, items[order[k]].input, run)) == NULL)
+            {
+                cgArenaRewind(scratch, mark);
+                return CG_FALSE;
+            }
+        }
+    }
+
+    cgArenaRewind(scratch, mark);
+
+    return CG_TRUE;
+}
+
+static int WritePreview(
+    cgMat2i img,
+    const char *fname,
+    int size
+)
+{
+    cgMat2i level = img;
+    cgMat2i half;
+
+    while ((level->height > size || level->width > size) && level->height >= 2 && level->width >= 2)
+    {
+        half = cgAllocateMat2iLayout(level->height / 2, level->width / 2, level->layout);
+        if (half == NULL || !cgDownsample2x2i(level, half))
+        {
+            if (half != NULL)
+                cgFreeMat2i(half);
+            if (level != img)
+                cgFreeMat2i(level);
+            return CG_FALSE;
+        }
+        if (level != img)
+            cgFreeMat2i(level);
+        level = half;
+    }
+
+    cgWritePGMImage(level, (char*) fname, CG_IMAGE_TYPE_PGM_RAW);
+
+    if (level != img)
+        cgFreeMat2i(level);
+
+    return FileSize(fname) > 0;
+}
+
+static void ProcessItem(
+    void *arg
+)
+{
+    cgBatchItem *item = (cgBatchItem*) arg;
+    const cgBatchOptions *opt = item->batch->opt;
+    cgMat2i img = NULL;
+    void *vertices = NULL;
+    uint32_t *indices = NULL;
+    size_t vertexBytes = 0, indexCount = 0;
+    size_t n, i;
+    long long sum = 0;
+    cgMeshKey key;
+    cgArena scratch = cgScratchArena();
+    size_t mark = (scratch != NULL) ? cgArenaMark(scratch) : 0;
+    char *fname;
+    double start = Now();
+
+    item->bytesIn = FileSize(item->input);
+
+    fname = (scratch != NULL) ? (char*) cgArenaAlloc(scratch, strlen(item->stem) + 32) : NULL;
+    if (fname == NULL)
+        goto done;
+
+    /* Read and filter; a truncated file is an error, not a partial image. */
+    img = cgIsTiledImage(item->input) ? cgReadTiledImage(item->input) : cgReadPGMImageAt(item->input, 0, NULL);
+    if (img == NULL)
+        goto done;
+
+    img = cgApplyFilters(img, opt->filters);
+    if (img == NULL)
+        goto done;
+
+    item->height = img->height;
+    item->width = img->width;
+
+    /* Mesh. */
+    if (opt->format == CG_MESH_FORMAT_HEIGHT)
+    {
+        vertices = cgBuildHeightMesh(img, NULL, opt->heightScale);
+        indices = cgBuildHeightIndices(img->height, img->width, &indexCount);
+        vertexBytes = (size_t) img->height * img->width * sizeof(cgHeightVertex);
+        if (vertices == NULL || indices == NULL)
+            goto done;
+    }
+    else
+    {
+        vertices = cgBuildFlatMesh(img, NULL);
+        vertexBytes = (size_t) img->height * img->width * CG_MESH_FLAT_VERTICES * sizeof(cgFlatVertex);
+        if (vertices == NULL)
+            goto done;
+    }
+
+    /* Write it in the cache format, so it can be mapped back directly. */
+    if (!cgMeshKeyFromFile(item->input, opt->format, item->batch->keyOptions, &key))
+        goto done;
+
+    sprintf(fname, "%s.cgmesh", item->stem);
+    if (!cgWriteMeshCache(fname, item->input, &key, img, vertices, vertexBytes, indices, indexCount))
+        goto done;
+    item->bytesOut += FileSize(fname);
+
+    cgPoolFree(vertices);
+    cgPoolFree(indices);
+    vertices = NULL;
+    indices = NULL;
+
+    /* Statistics. */
+    item->min = cgMatMinValue2i(img);
+    item->max = cgMatMaxValue2i(img);
+    n = cgMatStorage2i(img);
+    for (i = 0; i < n; i++)
+        sum += img->data[i];
+    item->mean = (double) sum / ((double) img->height * img->width);
+
+    /* Preview. */
+    if (opt->previewSize > 0)
+    {
+        sprintf(fname, "%s.preview.pgm", item->stem);
+        if (!WritePreview(img, fname, opt->previewSize))
+            goto done;
+        item->bytesOut += FileSize(fname);
+    }
+
+    item->ok = CG_TRUE;
+
+done:
+    if (!item->ok)
+    {
+        char str[PATH_MAX + 32];
+        snprintf(str, sizeof(str), "Unable to convert %s", item->input);
+        cgError("cgRunBatch", str);
+    }
+
+    if (img != NULL)
+        cgFreeMat2i(img);
+    cgPoolFree(vertices);
+    cgPoolFree(indices);
+
+    /* The next image starts from one chunk large enough for this one; an
+     * item run by a thread waiting inside another only gives back its own
+     * part. */
+    if (scratch != NULL && mark == 0)
+        cgResetArena(scratch);
+    else if (scratch != NULL)
+        cgArenaRewind(scratch, mark);
+
+    item->ms = (Now() - start) * 1000.0;
+    __atomic_sub_fetch(&item->batch->inflight, item->estimate, __ATOMIC_SEQ_CST);
+}
+
+static int WriteStats(
+    const cgBatchOptions *opt,
+    const cgBatchItem *items,
+    int count
+)
+{
+    char *fname = (char*) malloc(strlen(opt->outDir) + 32);
+    int i;
+
+    if (fname == NULL)
+        return CG_FALSE;
+
+    sprintf(fname, "%s/stats.csv", opt->outDir);
+    FILE *fp = fopen(fname, "w");
+    free(fname);
+    if (fp == NULL)
+        return CG_FALSE;
+
+    fprintf(fp, "file,width,height,min,max,mean,ms,status\n");
+    for (i = 0; i < count; i++)
+    {
+        if (items[i].ok)
+            fprintf(fp, "\"%s\",%d,%d,%d,%d,%.3f,%.3f,ok\n", items[i].input,
+                    items[i].width, items[i].height, items[i].min, items[i].max,
+                    items[i].mean, items[i].ms);
+        else
+            fprintf(fp, "\"%s\",,,,,,%.3f,error\n", items[i].input, items[i].ms);
+    }
+
+    return fclose(fp) == 0;
+}
+
+int cgRunBatch(
+    char **inputs,
+    int count,
+    const cgBatchOptions *opt,
+    cgBatchStats *stats
+)
+{
+    cgBatch batch;
+    cgBatchItem *items;
+    cgTaskGroup group;
+    size_t estimate;
+    double start = Now();
+    int i, failed = 0;
+
+    /* Totals stay zero if the batch cannot start. */
+    if (stats != NULL)
+        memset(stats, 0, sizeof(*stats));
+
+    if (mkdir(opt->outDir, 0755) != 0 && errno != EEXIST)
+    {
+        cgError("cgRunBatch", "Unable to create the output directory.");
+        return CG_FALSE;
+    }
+
+    /* The height scale is part of the key, as in the viewer. */
+    batch.opt = opt;
+    batch.inflight = 0;
+    if (opt->format == CG_MESH_FORMAT_HEIGHT)
+        snprintf(batch.keyOptions, sizeof(batch.keyOptions), "%s;height=%f",
+                 opt->filters ? opt->filters : "", opt->heightScale);
+    else
+        snprintf(batch.keyOptions, sizeof(batch.keyOptions), "%s", opt->filters ? opt->filters : "");
+
+    items = (cgBatchItem*) cgPoolCalloc(count > 0 ? count : 1, sizeof(cgBatchItem));
+    if (items == NULL)
+    {
+        cgError("cgRunBatch", "No memory available.");
+        return CG_FALSE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        items[i].batch = &batch;
+        items[i].input = inputs[i];
+        if ((items[i].stem = OutputStem(opt->outDir, inputs[i], 0)) == NULL)
+            break;
+    }
+
+    if (i < count || !UniqueStems(items, count, opt->outDir))
+    {
+        cgError("cgRunBatch", "No memory available.");
+        for (i = 0; i < count; i++)
+            free(items[i].stem);
+        cgPoolFree(items);
+        return CG_FALSE;
+    }
+
+    /* Admit files while they fit in the budget; a file larger than the
+     * budget runs alone. The waiting thread keeps running tasks. */
+    cgTaskGroupInit(&group);
+    for (i = 0; i < count; i++)
+    {
+        estimate = EstimateBytes(inputs[i], opt);
+        if (estimate > opt->memoryBudget)
+            estimate = opt->memoryBudget;
+        items[i].estimate = estimate;
+
+        while (__atomic_load_n(&batch.inflight, __ATOMIC_SEQ_CST) + estimate > opt->memoryBudget)
+        {
+            if (!cgJobsRunPending())
+                sched_yield();
+        }
+
+        __atomic_add_fetch(&batch.inflight, estimate, __ATOMIC_SEQ_CST);
+        cgTaskGroupRun(&group, ProcessItem, &items[i]);
+    }
+    cgTaskGroupWait(&group);
+
+    if (!WriteStats(opt, items, count))
+        cgError("cgRunBatch", "Unable to write stats.csv.");
+
+    for (i = 0; i < count; i++)
+    {
+        if (!items[i].ok)
+            failed++;
+        if (stats != NULL)
+        {
+            stats->bytesIn += items[i].bytesIn;
+            stats->bytesOut += items[i].bytesOut;
+        }
+        free(items[i].stem);
+    }
+    cgPoolFree(items);
+
+    if (stats != NULL)
+    {
+        stats->files = count;
+        stats->failed = failed;
+        stats->seconds = Now() - start;
+    }
+
+    return (failed == 0) ? CG_TRUE : CG_FALSE;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file cgBatch.h
+ * @brief Declaration of the batch conversion functions.
+ *
+ * A batch turns many images into meshes, previews and statistics without a
+ * window. Every file is a task on the job system that reads, filters,
+ * meshes and writes it; the kernels inside a task run in parallel as well.
+ * Files are admitted while their estimated memory fits in a budget, and a
+ * file that fails is reported without stopping the others.
+ */
+
+
+#ifndef _CGBATCH_H_
+#define _CGBATCH_H_
+
+
+/* Includes. */
+#include <stdint.h>
+#include "cgImage.h"
+
+
+/* Defines. */
+#define CG_BATCH_PREVIEW_SIZE 256
+#define CG_BATCH_MEMORY_MB    1024
+
+
+/* Types. */
+
+/// cgBatchOptions
+/** What a batch produces for each input.
+ */
+typedef struct cg_batch_options
+{
+    /// Output directory.
+    /** Created if missing. Receives NAME.cgmesh, NAME.preview.pgm and
+     * stats.csv. */
+    const char *outDir;
+    /// Filter chain.
+    /** Same syntax as cgApplyFilters (NULL or empty for none). */
+    const char *filters;
+    /// Mesh format.
+    /** CG_MESH_FORMAT_FLAT or CG_MESH_FORMAT_HEIGHT. */
+    int format;
+    /// Height scale.
+    /** Used by CG_MESH_FORMAT_HEIGHT. */
+    float heightScale;
+    /// Preview size.
+    /** Previews are halved until both sides fit; 0 disables them. */
+    int previewSize;
+    /// Memory budget.
+    /** Estimated bytes of the files in flight. */
+    size_t memoryBudget;
+
+} cgBatchOptions;
+
+/// cgBatchStats
+/** Totals of a batch.
+ */
+typedef struct cg_batch_stats
+{
+    /// Files.
+    /** Number of inputs processed. */
+    int files;
+    /// Failures.
+    /** Number of inputs that could not be converted. */
+    int failed;
+    /// Input bytes.
+    /** Size of the inputs read. */
+    uint64_t bytesIn;
+    /// Output bytes.
+    /** Size of the files written. */
+    uint64_t bytesOut;
+    /// Time.
+    /** Wall time in seconds. */
+    double seconds;
+
+} cgBatchStats;
+
+
+/* Functions. */
+
+/// Expand inputs.
+/**
+ * This function expands a list of arguments into file names. Arguments
+ * with wildcards are expanded as globs (in sorted order) and "@FILE" reads
+ * one name per line from FILE; other arguments are kept as they are.
+ * @param args arguments.
+ * @param count number of arguments.
+ * @param total returned number of file names.
+ * @return file names (free with cgFreeBatchInputs) or NULL in error.
+ */
+char **cgExpandBatchInputs(
+    char **args,
+    int count,
+    int *total
+);
+
+/// Free inputs.
+/**
+ * This function frees the names returned by cgExpandBatchInputs.
+ * @param inputs file names.
+ * @param count number of file names.
+ */
+void cgFreeBatchInputs(
+    char **inputs,
+    int count
+);
+
+/// Run batch.
+/**
+ * This function converts every input and writes one line per input to
+ * stats.csv, in input order. Outputs are named after the input without its
+ * extension; repeated names get a numeric suffix.
+ * @param inputs file names (PGM or tiled).
+ * @param count number of file names.
+ * @param opt options.
+ * @param stats returned totals, zero if the batch could not start (may be
+ * NULL).
+ * @return CG_TRUE if every input was converted; CG_FALSE otherwise.
+ */
+int cgRunBatch(
+    char **inputs,
+    int count,
+    const cgBatchOptions *opt,
+    cgBatchStats *stats
+);
+
+#endif /* _CGBATCH_H_ */
@@ -0,0 +1,656 @@
+/**
+ * @file cgContour.c
+ * @brief Implementation of the isoline extraction functions.
+ */
+
+
+#include "cgContour.h"
+#include "cgJobs.h"
+#include "cgMesh.h"
+#include "cgPool.h"
+
+
+/* Cell edges. */
+#define EDGE_TOP    0
+#define EDGE_RIGHT  1
+#define EDGE_BOTTOM 2
+#define EDGE_LEFT   3
+
+#define NO_KEY UINT64_MAX
+
+
+/* A piece of polyline: its points and the crossings at both ends. */
+typedef struct cg_fragment
+{
+    int level;
+    uint64_t head;
+    uint64_t tail;
+    size_t offset;
+    size_t count;
+    const float *points;
+    int closed;
+
+} cgFragment;
+
+/* Fragments and their points, grown as needed. */
+typedef struct cg_fragment_list
+{
+    cgFragment *frags;
+    int count;
+    int capacity;
+    float *points;
+    size_t pointCount;
+    size_t pointCapacity;
+
+} cgFragmentList;
+
+typedef struct cg_end_entry
+{
+    uint64_t key;
+    int frag;
+    int end;
+
+} cgEndEntry;
+
+typedef struct cg_contour_job
+{
+    cgMat2i img;
+    const float *levels;
+    int levelCount;
+    int tilesX;
+    cgFragmentList *tiles;
+
+} cgContourJob;
+
+
+/* Segments of each case (corner bits: top-left 8, top-right 4,
+ * bottom-right 2, bottom-left 1), as pairs of edges. Saddles (5 and 10)
+ * list the pair used when the center is outside; the other pairing is
+ * used when it is inside. */
+static const signed char segmentTable[16][4] = {
+    {-1, -1, -1, -1},
+    {EDGE_LEFT, EDGE_BOTTOM, -1, -1},
+    {EDGE_BOTTOM, EDGE_RIGHT, -1, -1},
+    {EDGE_LEFT, EDGE_RIGHT, -1, -1},
+    {EDGE_TOP, EDGE_RIGHT, -1, -1},
+    {EDGE_TOP, EDGE_RIGHT, EDGE_LEFT, EDGE_BOTTOM},
+    {EDGE_TOP, EDGE_BOTTOM, -1, -1},
+    {EDGE_LEFT, EDGE_TOP, -1, -1},
+    {EDGE_LEFT, EDGE_TOP, -1, -1},
+    {EDGE_TOP, EDGE_BOTTOM, -1, -1},
+    {EDGE_LEFT, EDGE_TOP, EDGE_BOTTOM, EDGE_RIGHT},
+    {EDGE_TOP, EDGE_RIGHT, -1, -1},
+    {EDGE_LEFT, EDGE_RIGHT, -1, -1},
+    {EDGE_BOTTOM, EDGE_RIGHT, -1, -1},
+    {EDGE_LEFT, EDGE_BOTTOM, -1, -1},
+    {-1, -1, -1, -1}
+};
+
+static const signed char saddleInside[2][4] = {
+    {EDGE_LEFT, EDGE_TOP, EDGE_BOTTOM, EDGE_RIGHT},
+    {EDGE_TOP, EDGE_RIGHT, EDGE_LEFT, EDGE_BOTTOM}
+};
+
+
+static int GrowFragments(
+    cgFragmentList *list
+)
+{
+    if (list->count < list->capacity)
+        return CG_TRUE;
+
+    int grown = (list->capacity > 0) ? 2 * list->capacity : 64;
+    cgFragment *p = (cgFragment*) cgPoolRealloc(list->frags, grown * sizeof(cgFragment));
+    if (p == NULL)
+        return CG_FALSE;
+    list->frags = p;
+    list->capacity = grown;
+
+    return CG_TRUE;
+}
+
+static int GrowPoints(
+    cgFragmentList *list,
+    size_t n
+)
+{
+    if (list->pointCount + n <= list->pointCapacity)
+        return CG_TRUE;
+
+    size_t grown = (list->pointCapacity > 0) ? 2 * list->pointCapacity : 256;
+    while (grown < list->pointCount + n)
+        grown *= 2;
+    float *p = (float*) cgPoolRealloc(list->points, grown * 2 * sizeof(float));
+    if (p == NULL)
+        return CG_FALSE;
+    list->points = p;
+    list->pointCapacity = grown;
+
+    return CG_TRUE;
+}
+
+static void FreeFragments(
+    cgFragmentList *list
+)
+{
+    cgPoolFree(list->frags);
+    cgPoolFree(list->points);
+}
+
+/* Fragments refer to their points by offset while the buffer may move. */
+static void ResolvePoints(
+    cgFragmentList *list
+)
+{
+    int i;
+
+    for (i = 0; i < list->count; i++)
+        list->frags[i].points = list->points + 2 * list->frags[i].offset;
+}
+
+static size_t HashKey(
+    uint64_t key,
+    size_t mask
+)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+
+    return (size_t) key & mask;
+}
+
+static uint64_t EndKey(
+    const cgFragment *f,
+    int end
+)
+{
+    return (end == 0) ? f->head : f->tail;
+}
+
+/* The other fragment end at the same crossing, or -1. A crossing joins at
+ * most two ends: one from each cell sharing the edge. */
+static int Partner(
+    const cgEndEntry *table,
+    size_t mask,
+    uint64_t key,
+    int frag,
+    int end,
+    int *partnerEnd
+)
+{
+    size_t h = HashKey(key, mask);
+
+    while (table[h].key != NO_KEY)
+    {
+        if (table[h].key == key && (table[h].frag != frag || table[h].end != end))
+        {
+            *partnerEnd = table[h].end;
+            return table[h].frag;
+        }
+        h = (h + 1) & mask;
+    }
+
+    return -1;
+}
+
+static void AppendPoints(
+    cgFragmentList *out,
+    const cgFragment *f,
+    int reverse,
+    int skipFirst
+)
+{
+    size_t i, k;
+
+    for (i = skipFirst ? 1 : 0; i < f->count; i++)
+    {
+        k = reverse ? f->count - 1 - i : i;
+        out->points[2 * out->pointCount]     = f->points[2 * k];
+        out->points[2 * out->pointCount + 1] = f->points[2 * k + 1];
+        out->pointCount++;
+    }
+}
+
+/* Joins fragments whose ends meet into longer fragments. The same routine
+ * chains the segments of a tile and the fragments of all tiles. */
+static int Chain(
+    const cgFragment *in,
+    int n,
+    cgFragmentList *out
+)
+{
+    cgArena scratch = cgScratchArena();
+    size_t size = 16, mask, h, mark, total = 0;
+    cgEndEntry *table;
+    unsigned char *visited;
+    int i, e, f, g, ge, loop;
+
+    while (size < 4 * (size_t) n)
+        size *= 2;
+    mask = size - 1;
+
+    if (scratch == NULL)
+        return CG_FALSE;
+    mark = cgArenaMark(scratch);
+    table = (cgEndEntry*) cgArenaAlloc(scratch, size * sizeof(cgEndEntry));
+    visited = (unsigned char*) cgArenaAlloc(scratch, n > 0 ? n : 1);
+    if (table == NULL || visited == NULL)
+    {
+        cgArenaRewind(scratch, mark);
+        return CG_FALSE;
+    }
+    memset(visited, 0, n > 0 ? n : 1);
+
+    for (h = 0; h < size; h++)
+        table[h].key = NO_KEY;
+
+    for (i = 0; i < n; i++)
+    {
+        total += in[i].count;
+        if (in[i].closed)
+            continue;
+        for (e = 0; e < 2; e++)
+        {
+            h = HashKey(EndKey(&in[i], e), mask);
+            while (table[h].key != NO_KEY)
+                h = (h + 1) & mask;
+            table[h].key = EndKey(&in[i], e);
+            table[h].frag = i;
+            table[h].end = e;
+        }
+    }
+
+    /* Joined fragments never have more points than the parts. */
+    if (!GrowPoints(out, total))
+    {
+        cgArenaRewind(scratch, mark);
+        return CG_FALSE;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (visited[i])
+            continue;
+
+        if (!GrowFragments(out))
+            break;
+
+        cgFragment *o = &out->frags[out->count++];
+        o->level = in[i].level;
+        o->offset = out->pointCount;
+
+        if (in[i].closed)
+        {
+            AppendPoints(out, &in[i], CG_FALSE, CG_FALSE);
+            o->head = o->tail = in[i].head;
+            o->count = in[i].count;
+            o->closed = CG_TRUE;
+            visited[i] = 1;
+            continue;
+        }
+
+        /* Walk back to the start of the chain, leaving each fragment by
+         * the end opposite to where it was entered. */
+        f = i;
+        e = 0;
+        loop = CG_FALSE;
+        while ((g = Partner(table, mask, EndKey(&in[f], e), f, e, &ge)) >= 0)
+        {
+            if (g == i)
+            {
+                loop = CG_TRUE;
+                f = i;
+                e = 0;
+                break;
+            }
+            f = g;
+            e = 1 - ge;
+        }
+
+        /* Walk forward from there, entering each fragment at end e. */
+        o->head = EndKey(&in[f], e);
+        AppendPoints(out, &in[f], e == 1, CG_FALSE);
+        visited[f] = 1;
+        while ((g = Partner(table, mask, EndKey(&in[f], 1 - e), f, 1 - e, &ge)) >= 0 && !visited[g])
+        {
+            f = g;
+            e = ge;
+            AppendPoints(out, &in[f], e == 1, CG_TRUE);
+            visited[f] = 1;
+        }
+        o->tail = EndKey(&in[f], 1 - e);
+
+        /* A loop ends on its first point. */
+        if (loop)
+            out->pointCount--;
+        o->closed = loop;
+        o->count = out->pointCount - o->offset;
+    }
+
+    cgArenaRewind(scratch, mark);
+
+    return i == n;
+}
+
+/* Crossing of a level on the edge of a cell, named by the edge and level. */
+static uint64_t Crossing(
+    const cgContourJob *job,
+    const int *v,
+    int stride,
+    int r,
+    int c,
+    int edge,
+    int level,
+    float *point
+)
+{
+    cgMat2i img = job->img;
+    float lv = job->levels[level];
+    int v0, v1, er = r, ec = c, vertical;
+    float t, row, col;
+
+    /* Corners of the edge; v points at the top-left pixel of the cell. */
+    switch (edge)
+    {
+        case EDGE_TOP:
+            v0 = v[0]; v1 = v[1]; vertical = 0;
+            break;
+        case EDGE_BOTTOM:
+            v0 = v[stride]; v1 = v[stride + 1]; vertical = 0; er = r + 1;
+            break;
+        case EDGE_LEFT:
+            v0 = v[0]; v1 = v[stride]; vertical = 1;
+            break;
+        default:
+            v0 = v[1]; v1 = v[stride + 1]; vertical = 1; ec = c + 1;
+            break;
+    }
+
+    t = (lv - v0) / (float) (v1 - v0);
+    row = vertical ? er + t : er;
+    col = vertical ? ec : ec + t;
+    point[0] = ((col + 0.5f) / img->width) * 2.0f - 1.0f;
+    point[1] = ((img->height - row - 0.5f) / img->height) * 2.0f - 1.0f;
+
+    return ((((uint64_t) er * img->width + ec) << 1 | vertical) * job->levelCount) + level;
+}
+
+static int TileSegments(
+    cgContourJob *job,
+    const int *vals,
+    int r0,
+    int r1,
+    int c0,
+    int c1,
+    cgFragmentList *segs
+)
+{
+    int stride = c1 - c0 + 1;
+    int l, r, c, k, bits;
+
+    for (l = 0; l < job->levelCount; l++)
+    {
+        float lv = job->levels[l];
+
+        for (r = r0; r < r1; r++)
+        {
+            for (c = c0; c < c1; c++)
+            {
+                const int *v = vals + (size_t) (r - r0) * stride + (c - c0);
+                const signed char *pairs;
+
+                bits = ((v[0] >= lv) << 3) | ((v[1] >= lv) << 2) |
+                       ((v[stride + 1] >= lv) << 1) | (v[stride] >= lv);
+                if (bits == 0 || bits == 15)
+                    continue;
+
+                pairs = segmentTable[bits];
+                if ((bits == 5 || bits == 10) &&
+                    (v[0] + v[1] + v[stride] + v[stride + 1]) * 0.25f >= lv)
+                    pairs = saddleInside[bits == 10];
+
+                for (k = 0; k < 4 && pairs[k] >= 0; k += 2)
+                {
+                    if (!GrowFragments(segs) || !GrowPoints(segs, 2))
+                        return CG_FALSE;
+
+                    cgFragment *s = &segs->frags[segs->count++];
+                    float *p = segs->points + 2 * segs->pointCount;
+                    s->level = l;
+                    s->offset = segs->pointCount;
+                    s->count = 2;
+                    s->closed = CG_FALSE;
+                    s->head = Crossing(job, v, stride, r, c, pairs[k], l, p);
+                    s->tail = Crossing(job, v, stride, r, c, pairs[k + 1], l, p + 2);
+                    segs->pointCount += 2;
+                }
+            }
+        }
+    }
+
+    return CG_TRUE;
+}
+
+/* Cells [r0, r1) x [c0, c1) of a tile: segments of every level, chained
+ * into the fragments of the tile. */
+static void TileBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgContourJob *job = (cgContourJob*) arg;
+    cgMat2i img = job->img;
+    cgArena scratch = cgScratchArena();
+    size_t mark;
+    int ty, tx, r, cr0, cr1, cc0, cc1;
+
+    for (ty = r0; ty < r1; ty++)
+    {
+        for (tx = c0; tx < c1; tx++)
+        {
+            cgFragmentList *tile = &job->tiles[ty * job->tilesX + tx];
+            cgFragmentList segs;
+            int *vals;
+
+            cr0 = ty * CG_CONTOUR_TILE;
+            cr1 = (cr0 + CG_CONTOUR_TILE < img->height - 1) ? cr0 + CG_CONTOUR_TILE : img->height - 1;
+            cc0 = tx * CG_CONTOUR_TILE;
+            cc1 = (cc0 + CG_CONTOUR_TILE < img->width - 1) ? cc0 + CG_CONTOUR_TILE : img->width - 1;
+
+            /* Cells need one more row and column of pixels. */
+            mark = (scratch != NULL) ? cgArenaMark(scratch) : 0;
+            vals = (scratch != NULL) ? (int*) cgArenaAlloc(scratch, (size_t) (cr1 - cr0 + 1) * (cc1 - cc0 + 1) * sizeof(int)) : NULL;
+            if (vals == NULL)
+            {
+                tile->count = -1;
+                continue;
+            }
+            for (r = cr0; r <= cr1; r++)
+                cgMatGetRow2i(img, r, cc0, cc1 + 1, vals + (size_t) (r - cr0) * (cc1 - cc0 + 1));
+
+            memset(&segs, 0, sizeof(segs));
+            if (!TileSegments(job, vals, cr0, cr1, cc0, cc1, &segs))
+            {
+                tile->count = -1;
+            }
+            else
+            {
+                ResolvePoints(&segs);
+                if (!Chain(segs.frags, segs.count, tile))
+                    tile->count = -1;
+            }
+
+            FreeFragments(&segs);
+            cgArenaRewind(scratch, mark);
+        }
+    }
+}
+
+cgContour cgExtractContours(
+    cgMat2i img,
+    const float *levels,
+    int levelCount
+)
+{
+    cgContourJob job;
+    cgFragmentList seams, all;
+    cgContour contour = NULL;
+    int tilesY, t, i, n = 0, ok = CG_TRUE;
+
+    if (img == NULL || img->height < 2 || img->width < 2)
+    {
+        cgError("cgExtractContours", "Image must be at least 2x2.");
+        return NULL;
+    }
+
+    job.img = img;
+    job.levels = levels;
+    job.levelCount = levelCount;
+    job.tilesX = (img->width - 1 + CG_CONTOUR_TILE - 1) / CG_CONTOUR_TILE;
+    tilesY = (img->height - 1 + CG_CONTOUR_TILE - 1) / CG_CONTOUR_TILE;
+    job.tiles = (cgFragmentList*) cgPoolCalloc((size_t) tilesY * job.tilesX, sizeof(cgFragmentList));
+    if (job.tiles == NULL)
+    {
+        cgError("cgExtractContours", "No memory available.");
+        return NULL;
+    }
+
+    cgParallelFor2D(0, tilesY, 0, job.tilesX, 1, 1, TileBlock, &job, NULL);
+
+    /* Join the fragments of all tiles across the seams. */
+    memset(&seams, 0, sizeof(seams));
+    memset(&all, 0, sizeof(all));
+    for (t = 0; t < tilesY * job.tilesX; t++)
+    {
+        if (job.tiles[t].count < 0)
+            ok = CG_FALSE;
+        else
+            n += job.tiles[t].count;
+    }
+
+    seams.frags = (cgFragment*) cgPoolAlloc((n > 0 ? n : 1) * sizeof(cgFragment));
+    if (ok && seams.frags != NULL)
+    {
+        for (t = 0; t < tilesY * job.tilesX; t++)
+        {
+            /* Tiles without isolines have no fragment array. */
+            if (job.tiles[t].count == 0)
+                continue;
+            ResolvePoints(&job.tiles[t]);
+            memcpy(seams.frags + seams.count, job.tiles[t].frags, job.tiles[t].count * sizeof(cgFragment));
+            seams.count += job.tiles[t].count;
+        }
+        ok = Chain(seams.frags, seams.count, &all);
+    }
+    else
+    {
+        ok = CG_FALSE;
+    }
+
+    for (t = 0; t < tilesY * job.tilesX; t++)
+        FreeFragments(&job.tiles[t]);
+    cgPoolFree(job.tiles);
+    cgPoolFree(seams.frags);
+
+    if (ok)
+        contour = (cgContour) cgPoolCalloc(1, sizeof(struct cg_contour));
+    if (contour != NULL)
+    {
+        contour->count  = all.count;
+        contour->first  = (size_t*) cgPoolAlloc((all.count + 1) * sizeof(size_t));
+        contour->level  = (int*) cgPoolAlloc((all.count > 0 ? all.count : 1) * sizeof(int));
+        contour->closed = (unsigned char*) cgPoolAlloc(all.count > 0 ? all.count : 1);
+        if (contour->first == NULL || contour->level == NULL || contour->closed == NULL)
+        {
+            cgFreeContour(contour);
+            contour = NULL;
+        }
+    }
+    if (contour == NULL)
+    {
+        cgError("cgExtractContours", "No memory available.");
+        FreeFragments(&all);
+        return NULL;
+    }
+
+    /* Polylines were written one after the other. */
+    for (i = 0; i < all.count; i++)
+    {
+        contour->first[i]  = all.frags[i].offset;
+        contour->level[i]  = all.frags[i].level;
+        contour->closed[i] = (unsigned char) all.frags[i].closed;
+    }
+    contour->first[all.count] = all.pointCount;
+    contour->points = all.points;
+    contour->maxval = img->maxval;
+    cgPoolFree(all.frags);
+
+    return contour;
+}
+
+cgFlatVertex *cgBuildContourLines(
+    cgContour contour,
+    const float *levels,
+    size_t *count
+)
+{
+    size_t segments = 0, n, k;
+    cgFlatVertex *vertices, *v;
+    float scale = 65535.0f / contour->maxval;
+    int i;
+
+    for (i = 0; i < contour->count; i++)
+    {
+        n = contour->first[i + 1] - contour->first[i];
+        segments += contour->closed[i] ? n : n - 1;
+    }
+
+    vertices = (cgFlatVertex*) cgPoolAlloc((segments > 0 ? 2 * segments : 1) * sizeof(cgFlatVertex));
+    if (vertices == NULL)
+    {
+        cgError("cgBuildContourLines", "No memory available.");
+        return NULL;
+    }
+
+    v = vertices;
+    for (i = 0; i < contour->count; i++)
+    {
+        const float *p = contour->points + 2 * contour->first[i];
+        uint16_t value = cgMeshValue(levels[contour->level[i]], scale);
+
+        n = contour->first[i + 1] - contour->first[i];
+        for (k = 0; k < (contour->closed[i] ? n : n - 1); k++)
+        {
+            size_t a = k, b = (k + 1) % n;
+
+            v->x = p[2 * a]; v->y = p[2 * a + 1];
+            v->value = value; v->pad = 0;
+            v++;
+            v->x = p[2 * b]; v->y = p[2 * b + 1];
+            v->value = value; v->pad = 0;
+            v++;
+        }
+    }
+
+    *count = 2 * segments;
+
+    return vertices;
+}
+
+void cgFreeContour(
+    cgContour contour
+)
+{
+    if (contour == NULL)
+        return;
+
+    cgPoolFree(contour->first);
+    cgPoolFree(contour->level);
+    cgPoolFree(contour->closed);
+    cgPoolFree(contour->points);
+    cgPoolFree(contour);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file cgContour.h
+ * @brief Declaration of the isoline extraction functions.
+ *
+ * Isolines are extracted by marching squares over the cells between pixel
+ * centers. Tiles of CG_CONTOUR_TILE x CG_CONTOUR_TILE cells run in
+ * parallel and chain their segments into fragments; the fragments are then
+ * joined across tile seams into polylines. Every crossing is named by its
+ * cell edge and level, so segments from different tiles meet exactly.
+ * Saddle cells are resolved by the mean of their corners.
+ */
+
+
+#ifndef _CGCONTOUR_H_
+#define _CGCONTOUR_H_
+
+
+/* Includes. */
+#include <stdint.h>
+#include "cgImage.h"
+#include "cgMesh.h"
+
+
+/* Defines. */
+#define CG_CONTOUR_TILE 64
+
+
+/* Types. */
+
+/// cgContour
+/** Polylines of one or more iso levels.
+ */
+typedef struct cg_contour
+{
+    /// Number of polylines.
+    int count;
+    /// First point.
+    /** Index of the first point of each polyline, plus the total number of
+     * points at the end (count + 1 entries). */
+    size_t *first;
+    /// Level.
+    /** Level index of each polyline. */
+    int *level;
+    /// Closed flag.
+    /** Whether each polyline is a loop (its last point joins the first). */
+    unsigned char *closed;
+    /// Points.
+    /** X and Y of each point, mapped to [-1, 1] as the pixel centers of
+     * the flat mesh. */
+    float *points;
+    /// Maximum intensity.
+    /** maxval of the image, used to normalize the levels. */
+    int maxval;
+
+} *cgContour;
+
+
+/* Functions. */
+
+/// Extract contours.
+/**
+ * This function extracts the isolines of an image. A pixel is inside a
+ * level if its intensity is at least the level.
+ * @param img image (at least 2x2).
+ * @param levels iso levels.
+ * @param levelCount number of levels.
+ * @return contour or NULL in error.
+ */
+cgContour cgExtractContours(
+    cgMat2i img,
+    const float *levels,
+    int levelCount
+);
+
+/// Build contour lines.
+/**
+ * This function writes the segments of all polylines as GL_LINES vertices
+ * in the flat vertex format, with the value of each line given by its
+ * level / maxval.
+ * @param contour contour.
+ * @param levels iso levels given to cgExtractContours.
+ * @param count returned number of vertices.
+ * @return vertex buffer (free with cgPoolFree) or NULL in error.
+ */
+cgFlatVertex *cgBuildContourLines(
+    cgContour contour,
+    const float *levels,
+    size_t *count
+);
+
+/// Free contour.
+/**
+ * This function frees a contour.
+ * @param contour contour.
+ */
+void cgFreeContour(
+    cgContour contour
+);
+
+#endif /* _CGCONTOUR_H_ */
@@ -0,0 +1,694 @@
+/**
+ * @file cgExport.c
+ * @brief Implementation of the mesh export functions.
+ */
+
+
+#include <math.h>
+#include <ctype.h>
+#include "cgExport.h"
+#include "cgJobs.h"
+#include "cgMesh.h"
+#include "cgPool.h"
+
+
+/* Most chunks encoded at once; bounds the buffers to a few MB per slot. */
+#define EXPORT_MAX_SLOTS 32
+
+/* Largest encoding of an item (text lines of the OBJ vertex are longest). */
+#define EXPORT_MAX_ITEM_BYTES 256
+
+/* Scratch floats of a slot: positions of three vertices per triangle, or
+ * positions, normals and colors of one vertex. */
+#define EXPORT_SCRATCH_FLOATS (9 * CG_EXPORT_CHUNK)
+
+
+typedef struct cg_export_job cgExportJob;
+
+typedef size_t (*EncodeFunc)(
+    cgExportJob *job,
+    size_t first,
+    size_t last,
+    char *out,
+    float *scratch
+);
+
+struct cg_export_job
+{
+    const cgExportMesh *mesh;
+    const float *m;
+    EncodeFunc encode;
+    size_t count;
+    size_t base;
+    char **buffers;
+    size_t *lengths;
+    float **scratch;
+};
+
+
+int cgExportTypeFromName(
+    const char *fname
+)
+{
+    const char *dot = strrchr(fname, '.');
+    char ext[8];
+    int i;
+
+    if (dot == NULL || strlen(dot + 1) >= sizeof(ext))
+        return CG_EXPORT_UNKNOWN;
+
+    for (i = 0; dot[i + 1] != '\0'; i++)
+        ext[i] = (char) tolower((unsigned char) dot[i + 1]);
+    ext[i] = '\0';
+
+    if (strcmp(ext, "ply") == 0)
+        return CG_EXPORT_PLY;
+    if (strcmp(ext, "obj") == 0)
+        return CG_EXPORT_OBJ;
+    if (strcmp(ext, "stl") == 0)
+        return CG_EXPORT_STL;
+
+    return CG_EXPORT_UNKNOWN;
+}
+
+void cgTransformPoints(
+    const float *m,
+    float *x,
+    float *y,
+    float *z,
+    size_t n
+)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        float px = x[i], py = y[i], pz = z[i];
+
+        x[i] = m[0] * px + m[4] * py + m[8] * pz + m[12];
+        y[i] = m[1] * px + m[5] * py + m[9] * pz + m[13];
+        z[i] = m[2] * px + m[6] * py + m[10] * pz + m[14];
+    }
+}
+
+void cgTransformNormals(
+    const float *m,
+    float *x,
+    float *y,
+    float *z,
+    size_t n
+)
+{
+    float c[9];
+    float det;
+    size_t i;
+
+    /* The cofactor matrix is the inverse transpose times the determinant;
+     * only its sign matters once the result is normalized. */
+    c[0] = m[5] * m[10] - m[6] * m[9];
+    c[1] = m[6] * m[8] - m[4] * m[10];
+    c[2] = m[4] * m[9] - m[5] * m[8];
+    c[3] = m[2] * m[9] - m[1] * m[10];
+    c[4] = m[0] * m[10] - m[2] * m[8];
+    c[5] = m[1] * m[8] - m[0] * m[9];
+    c[6] = m[1] * m[6] - m[2] * m[5];
+    c[7] = m[2] * m[4] - m[0] * m[6];
+    c[8] = m[0] * m[5] - m[1] * m[4];
+
+    det = m[0] * c[0] + m[1] * c[1] + m[2] * c[2];
+    if (det < 0.0f)
+        for (i = 0; i < 9; i++)
+            c[i] = -c[i];
+
+    for (i = 0; i < n; i++)
+    {
+        float px = x[i], py = y[i], pz = z[i];
+        float qx = c[0] * px + c[3] * py + c[6] * pz;
+        float qy = c[1] * px + c[4] * py + c[7] * pz;
+        float qz = c[2] * px + c[5] * py + c[8] * pz;
+        float len = sqrtf(qx * qx + qy * qy + qz * qz);
+        float inv = (len > 0.0f) ? 1.0f / len : 0.0f;
+
+        x[i] = qx * inv;
+        y[i] = qy * inv;
+        z[i] = qz * inv;
+    }
+}
+
+static float UnpackComponent(
+    uint32_t v,
+    int shift
+)
+{
+    /* Sign-extend the 10-bit field. */
+    return (float) ((int32_t) (v << (22 - shift)) >> 22) / 511.0f;
+}
+
+static unsigned char ColorByte(
+    float c
+)
+{
+    c = (c < 0.0f) ? 0.0f : ((c > 1.0f) ? 1.0f : c);
+
+    return (unsigned char) (c * 255.0f + 0.5f);
+}
+
+static size_t TriangleCount(
+    const cgExportMesh *mesh
+)
+{
+    return (mesh->indices != NULL) ? mesh->indexCount / 3 : mesh->vertexCount / 3;
+}
+
+static uint32_t TriangleIndex(
+    const cgExportMesh *mesh,
+    size_t t,
+    int k
+)
+{
+    return (mesh->indices != NULL) ? mesh->indices[3 * t + k] : (uint32_t) (3 * t + k);
+}
+
+static void LoadPosition(
+    const cgExportMesh *mesh,
+    size_t i,
+    float *x,
+    float *y,
+    float *z
+)
+{
+    if (mesh->format == CG_MESH_FORMAT_HEIGHT)
+    {
+        const cgHeightVertex *v = (const cgHeightVertex*) mesh->vertices + i;
+        *x = v->x;
+        *y = v->y;
+        *z = v->z * mesh->heightScale;
+    }
+    else
+    {
+        const cgFlatVertex *v = (const cgFlatVertex*) mesh->vertices + i;
+        *x = v->x;
+        *y = v->y;
+        *z = 0.0f;
+    }
+}
+
+/* Gathers the vertices [first, first + n) into scratch as separate arrays
+ * (x, y, z, nx, ny, nz, r, g, b) and transforms them. */
+static void LoadVertices(
+    cgExportJob *job,
+    size_t first,
+    size_t n,
+    float *s
+)
+{
+    const cgExportMesh *mesh = job->mesh;
+    float *x = s, *y = s + CG_EXPORT_CHUNK, *z = s + 2 * CG_EXPORT_CHUNK;
+    float *nx = s + 3 * CG_EXPORT_CHUNK, *ny = s + 4 * CG_EXPORT_CHUNK, *nz = s + 5 * CG_EXPORT_CHUNK;
+    float *r = s + 6 * CG_EXPORT_CHUNK, *g = s + 7 * CG_EXPORT_CHUNK, *b = s + 8 * CG_EXPORT_CHUNK;
+    size_t i;
+
+    if (mesh->format == CG_MESH_FORMAT_HEIGHT)
+    {
+        const cgHeightVertex *v = (const cgHeightVertex*) mesh->vertices + first;
+        for (i = 0; i < n; i++)
+        {
+            x[i] = v[i].x;
+            y[i] = v[i].y;
+            z[i] = v[i].z * mesh->heightScale;
+            nx[i] = UnpackComponent(v[i].normal, 0);
+            ny[i] = UnpackComponent(v[i].normal, 10);
+            nz[i] = UnpackComponent(v[i].normal, 20);
+            r[i] = g[i] = b[i] = v[i].z;
+        }
+    }
+    else
+    {
+        const cgFlatVertex *v = (const cgFlatVertex*) mesh->vertices + first;
+        for (i = 0; i < n; i++)
+        {
+            x[i] = v[i].x;
+            y[i] = v[i].y;
+            z[i] = 0.0f;
+            r[i] = g[i] = b[i] = v[i].value / 65535.0f;
+        }
+    }
+
+    if (job->m != NULL)
+    {
+        cgTransformPoints(job->m, x, y, z, n);
+        if (mesh->format == CG_MESH_FORMAT_HEIGHT)
+            cgTransformNormals(job->m, nx, ny, nz, n);
+    }
+}
+
+static char *PutUInt(
+    char *p,
+    unsigned long long v
+)
+{
+    char tmp[24];
+    int n = 0;
+
+    do
+    {
+        tmp[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+
+    while (n > 0)
+        *p++ = tmp[--n];
+
+    return p;
+}
+
+/* Six decimals without trailing zeros; much faster than printf. */
+static char *PutFloat(
+    char *p,
+    float v
+)
+{
+    unsigned long long f;
+    unsigned int frac;
+    int k;
+
+    if (!(v > -1e9f && v < 1e9f))
+        return p + sprintf(p, "%g", v);
+
+    if (v < 0.0f)
+    {
+        *p++ = '-';
+        v = -v;
+    }
+
+    f = (unsigned long long) ((double) v * 1e6 + 0.5);
+    p = PutUInt(p, f / 1000000);
+    frac = (unsigned int) (f % 1000000);
+
+    if (frac != 0)
+    {
+        *p++ = '.';
+        for (k = 100000; k > 0 && frac != 0; k /= 10)
+        {
+            *p++ = (char) ('0' + frac / k);
+            frac %= k;
+        }
+    }
+
+    return p;
+}
+
+static size_t EncodePLYVertices(
+    cgExportJob *job,
+    size_t first,
+    size_t last,
+    char *out,
+    float *s
+)
+{
+    size_t n = last - first, i;
+    int normals = job->mesh->format == CG_MESH_FORMAT_HEIGHT;
+    char *p = out;
+
+    LoadVertices(job, first, n, s);
+
+    for (i = 0; i < n; i++)
+    {
+        memcpy(p, &s[i], 4);
+        memcpy(p + 4, &s[CG_EXPORT_CHUNK + i], 4);
+        memcpy(p + 8, &s[2 * CG_EXPORT_CHUNK + i], 4);
+        p += 12;
+        if (normals)
+        {
+            memcpy(p, &s[3 * CG_EXPORT_CHUNK + i], 4);
+            memcpy(p + 4, &s[4 * CG_EXPORT_CHUNK + i], 4);
+            memcpy(p + 8, &s[5 * CG_EXPORT_CHUNK + i], 4);
+            p += 12;
+        }
+        p[0] = (char) ColorByte(s[6 * CG_EXPORT_CHUNK + i]);
+        p[1] = (char) ColorByte(s[7 * CG_EXPORT_CHUNK + i]);
+        p[2] = (char) ColorByte(s[8 * CG_EXPORT_CHUNK + i]);
+        p += 3;
+    }
+
+    return p - out;
+}
+
+static size_t EncodePLYFaces(
+    cgExportJob *job,
+    size_t first,
+    size_t last,
+    char *out,
+    float *s
+)
+{
+    char *p = out;
+    uint32_t idx[3];
+    size_t t;
+
+    (void) s;
+
+    for (t = first; t < last; t++)
+    {
+        idx[0] = TriangleIndex(job->mesh, t, 0);
+        idx[1] = TriangleIndex(job->mesh, t, 1);
+        idx[2] = TriangleIndex(job->mesh, t, 2);
+        *p = 3;
+        memcpy(p + 1, idx, 12);
+        p += 13;
+    }
+
+    return p - out;
+}
+
+static size_t EncodeOBJVertices(
+    cgExportJob *job,
+    size_t first,
+    size_t last,
+    char *out,
+    float *s
+)
+{
+    size_t n = last - first, i;
+    int normals = job->mesh->format == CG_MESH_FORMAT_HEIGHT;
+    int k;
+    char *p = out;
+
+    LoadVertices(job, first, n, s);
+
+    /* Vertex colors follow the position, as most readers accept. */
+    for (i = 0; i < n; i++)
+    {
+        *p++ = 'v';
+        for (k = 0; k < 3; k++)
+        {
+            *p++ = ' ';
+            p = PutFloat(p, s[k * CG_EXPORT_CHUNK + i]);
+        }
+        for (k = 6; k < 9; k++)
+        {
+            *p++ = ' ';
+            p = PutFloat(p, s[k * CG_EXPORT_CHUNK + i]);
+        }
+        *p++ = '\n';
+
+        if (normals)
+        {
+            *p++ = 'v';
+            *p++ = 'n';
+            for (k = 3; k < 6; k++)
+            {
+                *p++ = ' ';
+                p = PutFloat(p, s[k * CG_EXPORT_CHUNK + i]);
+            }
+            *p++ = '\n';
+        }
+    }
+
+    return p - out;
+}
+
+static size_t EncodeOBJFaces(
+    cgExportJob *job,
+    size_t first,
+    size_t last,
+    char *out,
+    float *s
+)
+{
+    int normals = job->mesh->format == CG_MESH_FORMAT_HEIGHT;
+    char *p = out;
+    size_t t;
+    int k;
+
+    (void) s;
+
+    for (t = first; t < last; t++)
+    {
+        *p++ = 'f';
+        for (k = 0; k < 3; k++)
+        {
+            unsigned long long v = (unsigned long long) TriangleIndex(job->mesh, t, k) + 1;
+            *p++ = ' ';
+            p = PutUInt(p, v);
+            if (normals)
+            {
+                *p++ = '/';
+                *p++ = '/';
+                p = PutUInt(p, v);
+            }
+        }
+        *p++ = '\n';
+    }
+
+    return p - out;
+}
+
+static size_t EncodeSTLTriangles(
+    cgExportJob *job,
+    size_t first,
+    size_t last,
+    char *out,
+    float *s
+)
+{
+    size_t n = last - first, i;
+    float *x = s, *y = s + 3 * CG_EXPORT_CHUNK, *z = s + 6 * CG_EXPORT_CHUNK;
+    char *p = out;
+    float rec[12];
+    int k;
+
+    for (i = 0; i < n; i++)
+        for (k = 0; k < 3; k++)
+            LoadPosition(job->mesh, TriangleIndex(job->mesh, first + i, k),
+                         &x[3 * i + k], &y[3 * i + k], &z[3 * i + k]);
+
+    if (job->m != NULL)
+        cgTransformPoints(job->m, x, y, z, 3 * n);
+
+    for (i = 0; i < n; i++)
+    {
+        float ax = x[3 * i + 1] - x[3 * i], ay = y[3 * i + 1] - y[3 * i], az = z[3 * i + 1] - z[3 * i];
+        float bx = x[3 * i + 2] - x[3 * i], by = y[3 * i + 2] - y[3 * i], bz = z[3 * i + 2] - z[3 * i];
+        float cx = ay * bz - az * by;
+        float cy = az * bx - ax * bz;
+        float cz = ax * by - ay * bx;
+        float len = sqrtf(cx * cx + cy * cy + cz * cz);
+        float inv = (len > 0.0f) ? 1.0f / len : 0.0f;
+
+        rec[0] = cx * inv;
+        rec[1] = cy * inv;
+        rec[2] = cz * inv;
+        for (k = 0; k < 3; k++)
+        {
+            rec[3 + 3 * k] = x[3 * i + k];
+            rec[4 + 3 * k] = y[3 * i + k];
+            rec[5 + 3 * k] = z[3 * i + k];
+        }
+
+        memcpy(p, rec, 48);
+        p[48] = 0;
+        p[49] = 0;
+        p += 50;
+    }
+
+    return p - out;
+}
+
+static void EncodeBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgExportJob *job = (cgExportJob*) arg;
+    size_t first, last;
+    int k;
+
+    (void) c0;
+    (void) c1;
+
+    for (k = r0; k < r1; k++)
+    {
+        first = job->base + (size_t) k * CG_EXPORT_CHUNK;
+        last = (first + CG_EXPORT_CHUNK < job->count) ? first + CG_EXPORT_CHUNK : job->count;
+        job->lengths[k] = job->encode(job, first, last, job->buffers[k], job->scratch[k]);
+    }
+}
+
+/* Encodes count items a batch of slots at a time and writes them in order. */
+static int WriteSection(
+    cgExportJob *job,
+    FILE *fp,
+    size_t count,
+    int slots,
+    EncodeFunc encode
+)
+{
+    size_t base;
+    int k, n;
+
+    job->encode = encode;
+    job->count = count;
+
+    for (base = 0; base < count; base += (size_t) slots * CG_EXPORT_CHUNK)
+    {
+        n = (int) ((count - base + CG_EXPORT_CHUNK - 1) / CG_EXPORT_CHUNK);
+        n = (n < slots) ? n : slots;
+
+        job->base = base;
+        cgParallelFor2D(0, n, 0, 1, 1, 1, EncodeBlock, job, NULL);
+
+        for (k = 0; k < n; k++)
+            if (fwrite(job->buffers[k], 1, job->lengths[k], fp) != job->lengths[k])
+                return CG_FALSE;
+    }
+
+    return CG_TRUE;
+}
+
+static int WritePLY(
+    cgExportJob *job,
+    FILE *fp,
+    int slots
+)
+{
+    const cgExportMesh *mesh = job->mesh;
+    int normals = mesh->format == CG_MESH_FORMAT_HEIGHT;
+
+    fprintf(fp, "ply\nformat binary_little_endian 1.0\ncomment opengl-cpp\n");
+    fprintf(fp, "element vertex %llu\n", (unsigned long long) mesh->vertexCount);
+    fprintf(fp, "property float x\nproperty float y\nproperty float z\n");
+    if (normals)
+        fprintf(fp, "property float nx\nproperty float ny\nproperty float nz\n");
+    fprintf(fp, "property uchar red\nproperty uchar green\nproperty uchar blue\n");
+    fprintf(fp, "element face %llu\n", (unsigned long long) TriangleCount(mesh));
+    fprintf(fp, "property list uchar uint vertex_indices\nend_header\n");
+
+    return WriteSection(job, fp, mesh->vertexCount, slots, EncodePLYVertices) &&
+           WriteSection(job, fp, TriangleCount(mesh), slots, EncodePLYFaces);
+}
+
+static int WriteOBJ(
+    cgExportJob *job,
+    FILE *fp,
+    int slots
+)
+{
+    fprintf(fp, "# opengl-cpp\n# %llu vertices, %llu triangles\n",
+            (unsigned long long) job->mesh->vertexCount,
+            (unsigned long long) TriangleCount(job->mesh));
+
+    return WriteSection(job, fp, job->mesh->vertexCount, slots, EncodeOBJVertices) &&
+           WriteSection(job, fp, TriangleCount(job->mesh), slots, EncodeOBJFaces);
+}
+
+static int WriteSTL(
+    cgExportJob *job,
+    FILE *fp,
+    int slots
+)
+{
+    char header[80];
+    uint32_t count = (uint32_t) TriangleCount(job->mesh);
+
+    memset(header, 0, sizeof(header));
+    strcpy(header, "opengl-cpp");
+
+    if (fwrite(header, 1, sizeof(header), fp) != sizeof(header) ||
+        fwrite(&count, sizeof(count), 1, fp) != 1)
+        return CG_FALSE;
+
+    return WriteSection(job, fp, TriangleCount(job->mesh), slots, EncodeSTLTriangles);
+}
+
+int cgWriteMeshFile(
+    const cgExportMesh *mesh,
+    const float *transform,
+    const char *fname,
+    int type
+)
+{
+    cgExportJob job;
+    cgArena scratch;
+    char str[PATH_MAX + 32];
+    size_t mark = 0;
+    int slots, k, ok;
+
+    if (mesh == NULL || mesh->vertices == NULL ||
+        (type != CG_EXPORT_PLY && type != CG_EXPORT_OBJ && type != CG_EXPORT_STL))
+    {
+        cgError("cgWriteMeshFile", "Invalid arguments.");
+        return CG_FALSE;
+    }
+
+    if (type == CG_EXPORT_STL && TriangleCount(mesh) > UINT32_MAX)
+    {
+        cgError("cgWriteMeshFile", "Too many triangles for STL.");
+        return CG_FALSE;
+    }
+
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL)
+    {
+        snprintf(str, sizeof(str), "Unable to open file %s", fname);
+        cgError("cgWriteMeshFile", str);
+        return CG_FALSE;
+    }
+
+    /* One slot per thread: each has an output buffer for a chunk and the
+     * scratch arrays of the transform, all taken from the scratch arena so
+     * repeated exports reuse the same memory. */
+    slots = cgJobsThreadCount();
+    slots = (slots < EXPORT_MAX_SLOTS) ? slots : EXPORT_MAX_SLOTS;
+
+    job.mesh = mesh;
+    job.m = transform;
+    scratch = cgScratchArena();
+    ok = scratch != NULL;
+    if (ok)
+    {
+        mark = cgArenaMark(scratch);
+        job.buffers = (char**) cgArenaAlloc(scratch, slots * sizeof(char*));
+        job.scratch = (float**) cgArenaAlloc(scratch, slots * sizeof(float*));
+        job.lengths = (size_t*) cgArenaAlloc(scratch, slots * sizeof(size_t));
+        ok = job.buffers != NULL && job.scratch != NULL && job.lengths != NULL;
+    }
+
+    for (k = 0; ok && k < slots; k++)
+    {
+        job.buffers[k] = (char*) cgArenaAlloc(scratch, (size_t) CG_EXPORT_CHUNK * EXPORT_MAX_ITEM_BYTES);
+        job.scratch[k] = (float*) cgArenaAlloc(scratch, EXPORT_SCRATCH_FLOATS * sizeof(float));
+        ok = job.buffers[k] != NULL && job.scratch[k] != NULL;
+    }
+
+    if (!ok)
+    {
+        cgError("cgWriteMeshFile", "No memory available.");
+    }
+    else
+    {
+        if (type == CG_EXPORT_PLY)
+            ok = WritePLY(&job, fp, slots);
+        else if (type == CG_EXPORT_OBJ)
+            ok = WriteOBJ(&job, fp, slots);
+        else
+            ok = WriteSTL(&job, fp, slots);
+
+        if (!ok)
+            cgError("cgWriteMeshFile", "Unable to write file.");
+    }
+
+    if (fclose(fp) != 0 && ok)
+    {
+        cgError("cgWriteMeshFile", "Unable to write file.");
+        ok = CG_FALSE;
+    }
+
+    if (scratch != NULL)
+        cgArenaRewind(scratch, mark);
+
+    return ok ? CG_TRUE : CG_FALSE;
+}
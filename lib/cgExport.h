@@ -0,0 +1,125 @@
+/**
+ * @file cgExport.h
+ * @brief Declaration of the mesh export functions.
+ *
+ * Meshes are written as binary PLY (indexed), OBJ or binary STL. The file
+ * is produced in chunks of CG_EXPORT_CHUNK vertices or triangles: a batch
+ * of chunks is encoded in parallel into fixed buffers and written in order,
+ * so no second copy of the mesh is ever built. An optional affine transform
+ * is applied on the way, on structure-of-arrays batches that the compiler
+ * vectorizes when optimizing (-O3).
+ */
+
+
+#ifndef _CGEXPORT_H_
+#define _CGEXPORT_H_
+
+
+/* Includes. */
+#include <stdint.h>
+#include "cgImage.h"
+
+
+/* Defines. */
+#define CG_EXPORT_UNKNOWN 0
+#define CG_EXPORT_PLY     1
+#define CG_EXPORT_OBJ     2
+#define CG_EXPORT_STL     3
+
+#define CG_EXPORT_CHUNK 16384
+
+
+/* Types. */
+
+/// cgExportMesh
+/** A mesh as built by cgMesh, in either format.
+ */
+typedef struct cg_export_mesh
+{
+    /// Format.
+    /** CG_MESH_FORMAT_FLAT or CG_MESH_FORMAT_HEIGHT. */
+    int format;
+    /// Vertices.
+    /** One cgFlatVertex or one cgHeightVertex each. */
+    const void *vertices;
+    /// Number of vertices.
+    size_t vertexCount;
+    /// Indices.
+    /** Triangle indices; NULL for the flat mesh, whose triangles are
+     * consecutive vertices. */
+    const uint32_t *indices;
+    /// Number of indices.
+    size_t indexCount;
+    /// Height scale.
+    /** Z scale of the height mesh (as in the shader). */
+    float heightScale;
+
+} cgExportMesh;
+
+
+/* Functions. */
+
+/// Export type from name.
+/**
+ * This function picks the export type from the file extension (.ply, .obj
+ * or .stl, in any case).
+ * @param fname file name.
+ * @return export type or CG_EXPORT_UNKNOWN.
+ */
+int cgExportTypeFromName(
+    const char *fname
+);
+
+/// Transform points.
+/**
+ * This function applies an affine transform to n points stored as separate
+ * coordinate arrays, in place.
+ * @param m 4x4 matrix in column-major order (as in OpenGL).
+ * @param x X coordinates.
+ * @param y Y coordinates.
+ * @param z Z coordinates.
+ * @param n number of points.
+ */
+void cgTransformPoints(
+    const float *m,
+    float *x,
+    float *y,
+    float *z,
+    size_t n
+);
+
+/// Transform normals.
+/**
+ * This function applies the inverse transpose of the linear part of an
+ * affine transform to n normals, in place, and normalizes them.
+ * @param m 4x4 matrix in column-major order (as in OpenGL).
+ * @param x X components.
+ * @param y Y components.
+ * @param z Z components.
+ * @param n number of normals.
+ */
+void cgTransformNormals(
+    const float *m,
+    float *x,
+    float *y,
+    float *z,
+    size_t n
+);
+
+/// Write mesh file.
+/**
+ * This function writes a mesh to a file.
+ * @param mesh mesh.
+ * @param transform 4x4 affine matrix in column-major order, or NULL.
+ * @param fname file name.
+ * @param type CG_EXPORT_PLY, CG_EXPORT_OBJ or CG_EXPORT_STL.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgWriteMeshFile(
+    const cgExportMesh *mesh,
+    const float *transform,
+    const char *fname,
+    int type
+);
+
+#endif /* _CGEXPORT_H_ */
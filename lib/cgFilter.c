@@ -0,0 +1,606 @@
+/**
+ * @file cgFilter.c
+ * @brief Implementation of the image filter kernels.
+ */
+
+
+#include <math.h>
+#include "cgFilter.h"
+#include "cgJobs.h"
+#include "cgPool.h"
+
+
+typedef struct cg_filter_job
+{
+    cgMat2i src;
+    cgMat2i dst;
+    const float *weights;
+    int radius;
+    const int *lut;
+    int *hist;
+    int maxval;
+    int t;
+    int low;
+    int high;
+
+} cgFilterJob;
+
+
+static int SameSize(
+    cgMat2i a,
+    cgMat2i b
+)
+{
+    return (a != NULL) && (b != NULL) && (a->height == b->height) && (a->width == b->width) &&
+           (a->layout == b->layout);
+}
+
+static cgMat2i CopyMat2i(
+    cgMat2i src
+)
+{
+    cgMat2i copy = cgAllocateMat2iLayout(src->height, src->width, src->layout);
+    if (copy == NULL)
+        return NULL;
+
+    memcpy(copy->data, src->data, cgMatStorage2i(src) * sizeof(int));
+    copy->maxval = src->maxval;
+
+    return copy;
+}
+
+/* Separable convolution of a block. The horizontal pass covers the block
+ * plus radius rows above and below, so the vertical pass reads only the
+ * block buffer. Inner loops run over contiguous columns. */
+static void ConvolveBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgFilterJob *job = (cgFilterJob*) arg;
+    int rad = job->radius;
+    int h = job->src->height;
+    int w = job->src->width;
+    int bw = c1 - c0;
+    int rows = r1 - r0 + 2 * rad;
+    int i, j, k, r, sr, lo, hi;
+
+    cgArena scratch = cgScratchArena();
+    if (scratch == NULL)
+    {
+        cgError("cgFilter", "No memory available.");
+        return;
+    }
+
+    size_t mark = cgArenaMark(scratch);
+    float *line = (float*) cgArenaAlloc(scratch, (bw + 2 * rad) * sizeof(float));
+    float *hbuf = (float*) cgArenaAlloc(scratch, (size_t) rows * bw * sizeof(float));
+    float *acc  = (float*) cgArenaAlloc(scratch, bw * sizeof(float));
+    int *pix    = (int*) cgArenaAlloc(scratch, (bw + 2 * rad) * sizeof(int));
+
+    if (line == NULL || hbuf == NULL || acc == NULL || pix == NULL)
+    {
+        cgError("cgFilter", "No memory available.");
+        cgArenaRewind(scratch, mark);
+        return;
+    }
+
+    /* Columns [lo, hi) of the padded line are inside the image. */
+    lo = (rad - c0 > 0) ? rad - c0 : 0;
+    hi = (w - c0 + rad < bw + 2 * rad) ? w - c0 + rad : bw + 2 * rad;
+
+    /* Horizontal pass. */
+    for (i = 0; i < rows; i++)
+    {
+        sr = r0 - rad + i;
+        sr = (sr < 0) ? 0 : ((sr >= h) ? h - 1 : sr);
+
+        float *out = hbuf + (size_t) i * bw;
+
+        /* Fetch the row once, then extend the borders. */
+        cgMatGetRow2i(job->src, sr, c0 - rad + lo, c0 - rad + hi, pix + lo);
+        for (j = lo; j < hi; j++)
+            line[j] = (float) pix[j];
+        for (j = 0; j < lo; j++)
+            line[j] = line[lo];
+        for (j = hi; j < bw + 2 * rad; j++)
+            line[j] = line[hi - 1];
+
+        for (j = 0; j < bw; j++)
+            out[j] = 0.0f;
+        for (k = 0; k <= 2 * rad; k++)
+        {
+            const float wk = job->weights[k];
+            const float *in = line + k;
+            for (j = 0; j < bw; j++)
+                out[j] += wk * in[j];
+        }
+    }
+
+    /* Vertical pass. */
+    for (r = r0; r < r1; r++)
+    {
+        for (j = 0; j < bw; j++)
+            acc[j] = 0.0f;
+        for (k = 0; k <= 2 * rad; k++)
+        {
+            const float wk = job->weights[k];
+            const float *in = hbuf + (size_t) (r - r0 + k) * bw;
+            for (j = 0; j < bw; j++)
+                acc[j] += wk * in[j];
+        }
+
+        for (j = 0; j < bw; j++)
+            pix[j] = (int) (acc[j] + 0.5f);
+        cgMatSetRow2i(job->dst, r, c0, c1, pix);
+    }
+
+    cgArenaRewind(scratch, mark);
+}
+
+static int Convolve(
+    cgMat2i src,
+    cgMat2i dst,
+    const float *weights,
+    int radius
+)
+{
+    cgFilterJob job;
+    cgMat2i copy = NULL;
+
+    /* Blocks read their neighbours' pixels, so in place needs a copy. */
+    if (src == dst)
+    {
+        copy = CopyMat2i(src);
+        if (copy == NULL)
+        {
+            cgError("cgFilter", "No memory available.");
+            return CG_FALSE;
+        }
+        src = copy;
+    }
+
+    job.src = src;
+    job.dst = dst;
+    job.weights = weights;
+    job.radius = radius;
+
+    cgParallelFor2D(0, src->height, 0, src->width, CG_FILTER_BLOCK_ROWS, CG_FILTER_BLOCK_COLS,
+                    ConvolveBlock, &job, NULL);
+
+    if (copy != NULL)
+        cgFreeMat2i(copy);
+
+    return CG_TRUE;
+}
+
+int cgBoxBlur2i(
+    cgMat2i src,
+    cgMat2i dst,
+    int radius
+)
+{
+    float *weights;
+    int k, ok;
+
+    if (!SameSize(src, dst) || radius < 0)
+    {
+        cgError("cgBoxBlur2i", "Invalid arguments.");
+        return CG_FALSE;
+    }
+
+    weights = (float*) cgPoolAlloc((2 * radius + 1) * sizeof(float));
+    if (weights == NULL)
+    {
+        cgError("cgBoxBlur2i", "No memory available.");
+        return CG_FALSE;
+    }
+
+    for (k = 0; k <= 2 * radius; k++)
+        weights[k] = 1.0f / (2 * radius + 1);
+
+    ok = Convolve(src, dst, weights, radius);
+    cgPoolFree(weights);
+
+    return ok;
+}
+
+int cgGaussianBlur2i(
+    cgMat2i src,
+    cgMat2i dst,
+    float sigma
+)
+{
+    float *weights, sum = 0.0f;
+    int k, radius, ok;
+
+    if (!SameSize(src, dst) || !(sigma > 0.0f))
+    {
+        cgError("cgGaussianBlur2i", "Invalid arguments.");
+        return CG_FALSE;
+    }
+
+    radius = (int) ceilf(3.0f * sigma);
+    weights = (float*) cgPoolAlloc((2 * radius + 1) * sizeof(float));
+    if (weights == NULL)
+    {
+        cgError("cgGaussianBlur2i", "No memory available.");
+        return CG_FALSE;
+    }
+
+    for (k = 0; k <= 2 * radius; k++)
+    {
+        weights[k] = expf(-(float) ((k - radius) * (k - radius)) / (2.0f * sigma * sigma));
+        sum += weights[k];
+    }
+    for (k = 0; k <= 2 * radius; k++)
+        weights[k] /= sum;
+
+    ok = Convolve(src, dst, weights, radius);
+    cgPoolFree(weights);
+
+    return ok;
+}
+
+/* Same tiled layout on both sides: a destination tile of side T is made of
+ * the four source tiles below it, one per quadrant. With Z order the four
+ * sources of a pixel are adjacent, so each quadrant is one linear pass.
+ * Tiles are owned by the block holding their origin; tiles beyond the
+ * source are padding and skipped. */
+static void DownsampleTiles(
+    cgFilterJob *job,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgMat2i src = job->src;
+    cgMat2i dst = job->dst;
+    int s = dst->tileLog2;
+    int t = 1 << s;
+    int h = t / 2;
+    int srcTilesY = (src->height + t - 1) >> s;
+    int tr, tc, q, i, j, y, x;
+
+    for (tr = (r0 + t - 1) & ~(t - 1); tr < r1; tr += t)
+    {
+        for (tc = (c0 + t - 1) & ~(t - 1); tc < c1; tc += t)
+        {
+            int *d = dst->data + cgMatIndex2i(dst, tr, tc);
+
+            for (q = 0; q < 4; q++)
+            {
+                int sty = 2 * (tr >> s) + (q >> 1);
+                int stx = 2 * (tc >> s) + (q & 1);
+
+                if (sty >= srcTilesY || stx >= src->tilesX)
+                    continue;
+
+                const int *p = src->data + (((size_t) sty * src->tilesX + stx) << (2 * s));
+
+                if (dst->layout == CG_LAYOUT_MORTON)
+                {
+                    int *dq = d + q * h * h;
+                    for (i = 0; i < h * h; i++)
+                        dq[i] = (p[4 * i] + p[4 * i + 1] + p[4 * i + 2] + p[4 * i + 3] + 2) >> 2;
+                }
+                else
+                {
+                    for (y = 0; y < h; y++)
+                    {
+                        const int *a = p + (2 * y) * t;
+                        const int *b = a + t;
+                        int *dr = d + ((q >> 1) * h + y) * t + (q & 1) * h;
+                        for (x = 0; x < h; x++)
+                        {
+                            j = 2 * x;
+                            dr[x] = (a[j] + a[j + 1] + b[j] + b[j + 1] + 2) >> 2;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void DownsampleBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgFilterJob *job = (cgFilterJob*) arg;
+    cgMatIter2i it;
+    int r, c;
+
+    if (job->src->layout == job->dst->layout && job->src->layout != CG_LAYOUT_ROW_MAJOR)
+    {
+        DownsampleTiles(job, r0, r1, c0, c1);
+        return;
+    }
+
+    /* Mixed layouts. */
+    if (job->src->layout != CG_LAYOUT_ROW_MAJOR || job->dst->layout != CG_LAYOUT_ROW_MAJOR)
+    {
+        cgMatIterBegin2i(&it, job->dst, r0, r1, c0, c1);
+        while (cgMatIterNext2i(&it))
+        {
+            r = 2 * it.r;
+            c = 2 * it.c;
+            *it.ptr = (cgMatAt2i(job->src, r, c) + cgMatAt2i(job->src, r, c + 1) +
+                       cgMatAt2i(job->src, r + 1, c) + cgMatAt2i(job->src, r + 1, c + 1) + 2) >> 2;
+        }
+        return;
+    }
+
+    for (r = r0; r < r1; r++)
+    {
+        const int *a = job->src->val[2 * r];
+        const int *b = job->src->val[2 * r + 1];
+        int *d = job->dst->val[r];
+
+        for (c = c0; c < c1; c++)
+            d[c] = (a[2 * c] + a[2 * c + 1] + b[2 * c] + b[2 * c + 1] + 2) >> 2;
+    }
+}
+
+int cgDownsample2x2i(
+    cgMat2i src,
+    cgMat2i dst
+)
+{
+    cgFilterJob job;
+
+    if (src == NULL || dst == NULL || src == dst ||
+        dst->height != src->height / 2 || dst->width != src->width / 2)
+    {
+        cgError("cgDownsample2x2i", "Invalid arguments.");
+        return CG_FALSE;
+    }
+
+    job.src = src;
+    job.dst = dst;
+    dst->maxval = src->maxval;
+
+    cgParallelFor2D(0, dst->height, 0, dst->width, CG_FILTER_BLOCK_ROWS, CG_FILTER_BLOCK_COLS,
+                    DownsampleBlock, &job, NULL);
+
+    return CG_TRUE;
+}
+
+static void HistogramBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgFilterJob *job = (cgFilterJob*) arg;
+    cgMatIter2i it;
+    int v;
+
+    /* Local counts, merged once per block. */
+    cgArena scratch = cgScratchArena();
+    size_t mark = (scratch != NULL) ? cgArenaMark(scratch) : 0;
+    int *local = (scratch != NULL) ? (int*) cgArenaAlloc(scratch, (job->maxval + 1) * sizeof(int)) : NULL;
+    if (local == NULL)
+    {
+        cgError("cgEqualizeHist2i", "No memory available.");
+        return;
+    }
+    memset(local, 0, (job->maxval + 1) * sizeof(int));
+
+    cgMatIterBegin2i(&it, job->src, r0, r1, c0, c1);
+    while (cgMatIterNext2i(&it))
+    {
+        v = *it.ptr;
+        v = (v < 0) ? 0 : ((v > job->maxval) ? job->maxval : v);
+        local[v]++;
+    }
+
+    for (v = 0; v <= job->maxval; v++)
+        if (local[v] != 0)
+            __atomic_add_fetch(&job->hist[v], local[v], __ATOMIC_RELAXED);
+
+    cgArenaRewind(scratch, mark);
+}
+
+static void LookupBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgFilterJob *job = (cgFilterJob*) arg;
+    cgMatIter2i it;
+    int v;
+
+    /* Source and destination share the layout, so one index serves both. */
+    cgMatIterBegin2i(&it, job->src, r0, r1, c0, c1);
+    while (cgMatIterNext2i(&it))
+    {
+        v = *it.ptr;
+        v = (v < 0) ? 0 : ((v > job->maxval) ? job->maxval : v);
+        job->dst->data[it.ptr - job->src->data] = job->lut[v];
+    }
+}
+
+int cgEqualizeHist2i(
+    cgMat2i src,
+    cgMat2i dst,
+    int maxval
+)
+{
+    cgFilterJob job;
+    long long cdf = 0, cdfMin = 0, total;
+    int *hist, *lut, v;
+
+    if (!SameSize(src, dst) || maxval <= 0)
+    {
+        cgError("cgEqualizeHist2i", "Invalid arguments.");
+        return CG_FALSE;
+    }
+
+    hist = (int*) cgPoolCalloc(maxval + 1, sizeof(int));
+    lut  = (int*) cgPoolAlloc((maxval + 1) * sizeof(int));
+    if (hist == NULL || lut == NULL)
+    {
+        cgError("cgEqualizeHist2i", "No memory available.");
+        cgPoolFree(hist);
+        cgPoolFree(lut);
+        return CG_FALSE;
+    }
+
+    job.src = src;
+    job.dst = dst;
+    job.hist = hist;
+    job.lut = lut;
+    job.maxval = maxval;
+
+    /* Histogram. */
+    cgParallelFor2D(0, src->height, 0, src->width, 4 * CG_FILTER_BLOCK_ROWS, src->width,
+                    HistogramBlock, &job, NULL);
+
+    /* Lookup table from the cumulative distribution. */
+    total = (long long) src->height * src->width;
+    for (v = 0; v <= maxval; v++)
+    {
+        cdf += hist[v];
+        if (cdfMin == 0)
+            cdfMin = cdf;
+        lut[v] = (total > cdfMin)
+                 ? (int) (((cdf - cdfMin) * maxval + (total - cdfMin) / 2) / (total - cdfMin))
+                 : v;
+    }
+
+    cgParallelFor2D(0, src->height, 0, src->width, CG_FILTER_BLOCK_ROWS, CG_FILTER_BLOCK_COLS,
+                    LookupBlock, &job, NULL);
+
+    cgPoolFree(hist);
+    cgPoolFree(lut);
+
+    return CG_TRUE;
+}
+
+static void ThresholdBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgFilterJob *job = (cgFilterJob*) arg;
+    cgMatIter2i it;
+
+    cgMatIterBegin2i(&it, job->src, r0, r1, c0, c1);
+    while (cgMatIterNext2i(&it))
+        job->dst->data[it.ptr - job->src->data] = (*it.ptr >= job->t) ? job->high : job->low;
+}
+
+int cgThreshold2i(
+    cgMat2i src,
+    cgMat2i dst,
+    int t,
+    int low,
+    int high
+)
+{
+    cgFilterJob job;
+
+    if (!SameSize(src, dst))
+    {
+        cgError("cgThreshold2i", "Invalid arguments.");
+        return CG_FALSE;
+    }
+
+    job.src = src;
+    job.dst = dst;
+    job.t = t;
+    job.low = low;
+    job.high = high;
+
+    cgParallelFor2D(0, src->height, 0, src->width, CG_FILTER_BLOCK_ROWS, CG_FILTER_BLOCK_COLS,
+                    ThresholdBlock, &job, NULL);
+
+    return CG_TRUE;
+}
+
+cgMat2i cgApplyFilters(
+    cgMat2i img,
+    const char *spec
+)
+{
+    char name[16];
+    const char *p = spec;
+    float arg;
+    int n, ok = CG_TRUE;
+
+    if (img == NULL || spec == NULL)
+        return img;
+
+    while (ok && *p != '\0')
+    {
+        /* Parse "name" or "name:arg". */
+        arg = 0.0f;
+        n = 0;
+        if (sscanf(p, "%15[a-z]%n", name, &n) != 1)
+        {
+            cgError("cgApplyFilters", "Invalid filter chain.");
+            ok = CG_FALSE;
+            break;
+        }
+        p += n;
+        if (*p == ':')
+        {
+            if (sscanf(p + 1, "%f%n", &arg, &n) != 1)
+            {
+                cgError("cgApplyFilters", "Invalid filter argument.");
+                ok = CG_FALSE;
+                break;
+            }
+            p += n + 1;
+        }
+        if (*p == ',')
+            p++;
+
+        if (strcmp(name, "box") == 0)
+            ok = cgBoxBlur2i(img, img, (int) arg);
+        else if (strcmp(name, "gauss") == 0)
+            ok = cgGaussianBlur2i(img, img, arg);
+        else if (strcmp(name, "eq") == 0)
+            ok = cgEqualizeHist2i(img, img, img->maxval);
+        else if (strcmp(name, "thr") == 0)
+            ok = cgThreshold2i(img, img, (int) arg, 0, img->maxval);
+        else if (strcmp(name, "down") == 0)
+        {
+            cgMat2i half = cgAllocateMat2iLayout(img->height / 2, img->width / 2, img->layout);
+            ok = (half != NULL) && cgDownsample2x2i(img, half);
+            cgFreeMat2i(img);
+            img = half;
+        }
+        else
+        {
+            cgError("cgApplyFilters", "Unknown filter.");
+            ok = CG_FALSE;
+        }
+    }
+
+    if (!ok)
+    {
+        if (img != NULL)
+            cgFreeMat2i(img);
+        return NULL;
+    }
+
+    return img;
+}
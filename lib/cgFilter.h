@@ -0,0 +1,117 @@
+/**
+ * @file cgFilter.h
+ * @brief Declaration of the image filter kernels.
+ *
+ * The kernels work on blocks of the image small enough to stay in the L1/L2
+ * caches, run the blocks in parallel on the job system and keep the inner
+ * loops simple enough for the compiler to vectorize when optimizing (-O3).
+ * All of them write to a preallocated destination, which may be the source
+ * itself unless noted.
+ */
+
+
+#ifndef _CGFILTER_H_
+#define _CGFILTER_H_
+
+
+/* Includes. */
+#include "cgImage.h"
+
+
+/* Defines. */
+#define CG_FILTER_BLOCK_ROWS 32
+#define CG_FILTER_BLOCK_COLS 512
+
+
+/* Functions. */
+
+/// Box blur.
+/**
+ * This function applies a separable box filter of size 2*radius+1.
+ * Borders are extended by replication.
+ * @param src source image.
+ * @param dst destination image (same size; may be src).
+ * @param radius filter radius.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgBoxBlur2i(
+    cgMat2i src,
+    cgMat2i dst,
+    int radius
+);
+
+/// Gaussian blur.
+/**
+ * This function applies a separable Gaussian filter truncated at 3 sigma.
+ * Borders are extended by replication.
+ * @param src source image.
+ * @param dst destination image (same size; may be src).
+ * @param sigma standard deviation in pixels.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgGaussianBlur2i(
+    cgMat2i src,
+    cgMat2i dst,
+    float sigma
+);
+
+/// Downsample by two.
+/**
+ * This function averages each 2x2 block of pixels. An odd last row or
+ * column is dropped.
+ * @param src source image.
+ * @param dst destination image of size (height/2, width/2); not src.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgDownsample2x2i(
+    cgMat2i src,
+    cgMat2i dst
+);
+
+/// Histogram equalization.
+/**
+ * This function equalizes the histogram of an image through a lookup table.
+ * @param src source image (values in [0, maxval]).
+ * @param dst destination image (same size; may be src).
+ * @param maxval maximum value of the input and output range.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgEqualizeHist2i(
+    cgMat2i src,
+    cgMat2i dst,
+    int maxval
+);
+
+/// Threshold.
+/**
+ * This function sets pixels >= t to high and the others to low.
+ * @param src source image.
+ * @param dst destination image (same size; may be src).
+ * @param t threshold.
+ * @param low value below the threshold.
+ * @param high value at or above the threshold.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgThreshold2i(
+    cgMat2i src,
+    cgMat2i dst,
+    int t,
+    int low,
+    int high
+);
+
+/// Apply filter chain.
+/**
+ * This function applies a comma separated chain of filters, in order:
+ * "box:R", "gauss:S", "down", "eq" and "thr:T". Filters that keep the size
+ * run in place; "down" replaces the image.
+ * @param img image (freed if replaced).
+ * @param spec filter chain (NULL or empty for none).
+ * @return filtered image or NULL in error (img is freed).
+ */
+cgMat2i cgApplyFilters(
+    cgMat2i img,
+    const char *spec
+);
+
+#endif /* _CGFILTER_H_ */
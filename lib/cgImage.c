@@ -5,17 +5,228 @@
  */
 
 
+#include <ctype.h>
 #include "cgImage.h"
+#include "cgJobs.h"
+#include "cgPool.h"
+
+
+/* Rows per parallel block of the reductions. */
+#define REDUCE_GRAIN_ROWS 64
+
+
+typedef struct cg_reduce_job
+{
+    cgMat2i mat;
+    int value;
+
+} cgReduceJob;
+
+typedef struct cg_pixel_job
+{
+    cgMat2i img;
+    unsigned char *data;
+    long size;
+    int bytes;
+    int chunks;
+    long *bounds;
+    long *first;
+
+} cgPixelJob;
+
+
+static void MinBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgReduceJob *job = (cgReduceJob*) arg;
+    cgMatIter2i it;
+    int min = INT_MAX;
+    int cur;
+
+    (void) c0;
+    (void) c1;
+
+    cgMatIterBegin2i(&it, job->mat, r0, r1, 0, job->mat->width);
+    while (cgMatIterNext2i(&it))
+        if (*it.ptr < min)
+            min = *it.ptr;
+
+    cur = __atomic_load_n(&job->value, __ATOMIC_RELAXED);
+    while (min < cur &&
+           !__atomic_compare_exchange_n(&job->value, &cur, min, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void MaxBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgReduceJob *job = (cgReduceJob*) arg;
+    cgMatIter2i it;
+    int max = -INT_MAX;
+    int cur;
+
+    (void) c0;
+    (void) c1;
+
+    cgMatIterBegin2i(&it, job->mat, r0, r1, 0, job->mat->width);
+    while (cgMatIterNext2i(&it))
+        if (*it.ptr > max)
+            max = *it.ptr;
+
+    cur = __atomic_load_n(&job->value, __ATOMIC_RELAXED);
+    while (max > cur &&
+           !__atomic_compare_exchange_n(&job->value, &cur, max, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static int IsSpace(
+    unsigned char c
+)
+{
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') ||
+           (c == '\v') || (c == '\f');
+}
+
+/* A token starts at a non-space character preceded by a space. */
+static int TokenStart(
+    const cgPixelJob *job,
+    long i
+)
+{
+    return !IsSpace(job->data[i]) && ((i == 0) || IsSpace(job->data[i - 1]));
+}
+
+static void CountTokensBlock(
+    void *arg,
+    int k0,
+    int k1,
+    int c0,
+    int c1
+)
+{
+    cgPixelJob *job = (cgPixelJob*) arg;
+    long i, n;
+    int k;
+
+    (void) c0;
+    (void) c1;
+
+    for (k = k0; k < k1; k++)
+    {
+        n = 0;
+        for (i = job->bounds[k]; i < job->bounds[k + 1]; i++)
+            n += TokenStart(job, i);
+        job->first[k] = n;
+    }
+}
+
+static void ParseTokensBlock(
+    void *arg,
+    int k0,
+    int k1,
+    int c0,
+    int c1
+)
+{
+    cgPixelJob *job = (cgPixelJob*) arg;
+    long total = (long) job->img->height * job->img->width;
+    long i, j, index;
+    int k, v, sign;
+
+    (void) c0;
+    (void) c1;
+
+    for (k = k0; k < k1; k++)
+    {
+        index = job->first[k];
+        for (i = job->bounds[k]; i < job->bounds[k + 1] && index < total; i++)
+        {
+            if (!TokenStart(job, i))
+                continue;
+
+            /* Tokens may run past the end of the chunk. */
+            j = i;
+            sign = 1;
+            if (job->data[j] == '-' || job->data[j] == '+')
+                sign = (job->data[j++] == '-') ? -1 : 1;
+            for (v = 0; j < job->size && job->data[j] >= '0' && job->data[j] <= '9'; j++)
+                v = v * 10 + (job->data[j] - '0');
+
+            job->img->data[index] = sign * v;
+            index++;
+        }
+    }
+}
+
+static void RawRowsBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgPixelJob *job = (cgPixelJob*) arg;
+    int w = job->img->width;
+    long avail = job->size / job->bytes;
+    long base;
+    int r, c, n;
+
+    (void) c0;
+    (void) c1;
+
+    for (r = r0; r < r1; r++)
+    {
+        base = (long) r * w;
+        if (base >= avail)
+            break;
+        n = (avail - base < w) ? (int) (avail - base) : w;
+
+        if (job->bytes == 1)
+        {
+            const unsigned char *p = job->data + base;
+            for (c = 0; c < n; c++)
+                job->img->val[r][c] = p[c];
+        }
+        else
+        {
+            /* Most significant byte first. */
+            const unsigned char *p = job->data + 2 * base;
+            for (c = 0; c < n; c++)
+                job->img->val[r][c] = (p[2 * c] << 8) | p[2 * c + 1];
+        }
+    }
+}
+
 
 cgMat2i cgAllocateMat2i(
     int height,
     int width
 )
+{
+    return cgAllocateMat2iLayout(height, width, CG_LAYOUT_ROW_MAJOR);
+}
+
+cgMat2i cgAllocateMat2iLayout(
+    int height,
+    int width,
+    int layout
+)
 {
     int r;
 
     /* Allocate structure. */
-    cgMat2i mat = (cgMat2i) malloc(sizeof(struct cg_mat_2i));
+    cgMat2i mat = (cgMat2i) cgPoolAlloc(sizeof(struct cg_mat_2i));
 
     if (mat == NULL)
     {
@@ -26,84 +237,216 @@ cgMat2i cgAllocateMat2i(
     /* Set properties. */
     mat->height = height;
     mat->width  = width;
+    mat->layout = layout;
+    mat->maxval = 255;
+    mat->val    = NULL;
+
+    if (layout == CG_LAYOUT_TILED)
+        mat->tileLog2 = CG_LAYOUT_TILED_LOG2;
+    else if (layout == CG_LAYOUT_MORTON)
+        mat->tileLog2 = CG_LAYOUT_MORTON_LOG2;
+    else
+        mat->tileLog2 = 0;
+
+    mat->tilesX = (layout == CG_LAYOUT_ROW_MAJOR) ? 0 :
+                  (width + (1 << mat->tileLog2) - 1) >> mat->tileLog2;
 
-    /* Allocate rows. */
-    mat->val = (int**) malloc(height*sizeof(int*));
+    /* Allocate pixels in a single block, recycled from the pool. */
+    mat->data = (int*) cgPoolCalloc(cgMatStorage2i(mat) > 0 ? cgMatStorage2i(mat) : 1, sizeof(int));
 
-    if (mat->val == NULL)
+    if (mat->data == NULL)
     {
         cgError("cgAllocateMat2i", "No memory available.");
+        cgPoolFree(mat);
         return NULL;
     }
 
-    /* Allocate columns for each row. */
-    for (r = 0; r < height; r++)
+    /* Row pointers. */
+    if (layout == CG_LAYOUT_ROW_MAJOR)
     {
-        mat->val[r] = (int*) malloc(width*sizeof(int));
-        
-        if (mat->val[r] == NULL)
+        mat->val = (int**) cgPoolAlloc((height > 0 ? height : 1) * sizeof(int*));
+
+        if (mat->val == NULL)
         {
             cgError("cgAllocateMat2i", "No memory available.");
+            cgPoolFree(mat->data);
+            cgPoolFree(mat);
             return NULL;
         }
 
-        memset(mat->val[r], 0, width*sizeof(int));
+        for (r = 0; r < height; r++)
+            mat->val[r] = mat->data + (size_t) r * width;
     }
 
     return mat;
 }
 
+size_t cgMatStorage2i(
+    cgMat2i mat
+)
+{
+    int s = mat->tileLog2;
+    size_t tilesY;
+
+    if (mat->layout == CG_LAYOUT_ROW_MAJOR)
+        return (size_t) mat->height * mat->width;
+
+    tilesY = (mat->height + (1 << s) - 1) >> s;
+
+    return (tilesY * mat->tilesX) << (2 * s);
+}
+
+cgMat2i cgConvertLayout2i(
+    cgMat2i mat,
+    int layout
+)
+{
+    cgMatIter2i it;
+
+    cgMat2i copy = cgAllocateMat2iLayout(mat->height, mat->width, layout);
+    if (copy == NULL)
+        return NULL;
+    copy->maxval = mat->maxval;
+
+    /* Walk the destination in its own storage order. */
+    cgMatIterBegin2i(&it, copy, 0, copy->height, 0, copy->width);
+    while (cgMatIterNext2i(&it))
+        *it.ptr = cgMatAt2i(mat, it.r, it.c);
+
+    return copy;
+}
+
+/* Copies a row segment between a matrix and a buffer. Tiled rows are
+ * contiguous inside a tile; Z-ordered rows step through the spread column
+ * bits, advanced with the masked increment trick. */
+static void CopyRow(
+    cgMat2i mat,
+    int r,
+    int c0,
+    int c1,
+    int *buf,
+    int toMat
+)
+{
+    int s = mat->tileLog2;
+    int m = (1 << s) - 1;
+    int c, e, n;
+
+    if (mat->layout == CG_LAYOUT_ROW_MAJOR)
+    {
+        if (toMat)
+            memcpy(mat->val[r] + c0, buf, (c1 - c0) * sizeof(int));
+        else
+            memcpy(buf, mat->val[r] + c0, (c1 - c0) * sizeof(int));
+        return;
+    }
+
+    for (c = c0; c < c1; c = e)
+    {
+        e = ((c | m) + 1 < c1) ? (c | m) + 1 : c1;
+        int *p = mat->data + cgMatIndex2i(mat, r, c & ~m);
+
+        if (mat->layout == CG_LAYOUT_TILED)
+        {
+            if (toMat)
+                memcpy(p + (c & m), buf + (c - c0), (e - c) * sizeof(int));
+            else
+                memcpy(buf + (c - c0), p + (c & m), (e - c) * sizeof(int));
+        }
+        else
+        {
+            unsigned int x = cgSpreadBits(c & m);
+            const unsigned int mask = 0x55555555u & ((1u << (2 * s)) - 1);
+
+            for (n = c; n < e; n++)
+            {
+                if (toMat)
+                    p[x] = buf[n - c0];
+                else
+                    buf[n - c0] = p[x];
+                x = ((x | ~mask) + 1) & mask;
+            }
+        }
+    }
+}
+
+void cgMatGetRow2i(
+    cgMat2i mat,
+    int r,
+    int c0,
+    int c1,
+    int *out
+)
+{
+    CopyRow(mat, r, c0, c1, out, CG_FALSE);
+}
+
+void cgMatSetRow2i(
+    cgMat2i mat,
+    int r,
+    int c0,
+    int c1,
+    const int *in
+)
+{
+    CopyRow(mat, r, c0, c1, (int*) in, CG_TRUE);
+}
+
 int cgMatMinValue2i(
     cgMat2i mat
 )
 {
-    int min; 
-    int r, c;
+    cgReduceJob job;
 
-    min = INT_MAX;
-    for (r = 0; r < mat->height; r++)
-        for (c = 0; c < mat->width; c++)
-            if (mat->val[r][c] < min)
-                min = mat->val[r][c];
+    job.mat = mat;
+    job.value = INT_MAX;
+    cgParallelFor2D(0, mat->height, 0, 1, REDUCE_GRAIN_ROWS, 1, MinBlock, &job, NULL);
 
-    return min;
+    return job.value;
 }
 
 int cgMatMaxValue2i(
     cgMat2i mat
 )
 {
-    int max; 
-    int r, c;
+    cgReduceJob job;
 
-    max = -INT_MAX;
-    for (r = 0; r < mat->height; r++)
-        for (c = 0; c < mat->width; c++)
-            if (mat->val[r][c] > max)
-                max = mat->val[r][c];
+    job.mat = mat;
+    job.value = -INT_MAX;
+    cgParallelFor2D(0, mat->height, 0, 1, REDUCE_GRAIN_ROWS, 1, MaxBlock, &job, NULL);
 
-    return max;
+    return job.value;
 }
 
-cgMat2i cgReadPGMImage(
-    const char *fname
+/* A short raster keeps the pixels read so far, unless strict. */
+static cgMat2i ReadPGM(
+    const char *fname,
+    long offset,
+    long *next,
+    int strict
 )
 {
-    int r, c;
-    unsigned char b, b1, b2;
-    unsigned short bb;
+    if (next != NULL)
+        *next = -1;
 
     /* Open file. */
     FILE *fp = fopen(fname, "r");
 
     if (fp == NULL)
     {
-	char *str = NULL;
-        sprintf(str, "Unable to open file %s", fname);
+        char str[PATH_MAX + 32];
+        snprintf(str, sizeof(str), "Unable to open file %s", fname);
         cgError("cgReadPGMImage", str); 
         return NULL;
     }
 
+    if (offset > 0 && fseek(fp, offset, SEEK_SET) != 0)
+    {
+        cgError("cgReadPGMImage", "Invalid offset.");
+        fclose(fp);
+        return NULL;
+    }
+
     /* Parse Header. */
     int nr, nc, mv, type;
 
@@ -114,7 +457,7 @@ cgMat2i cgReadPGMImage(
         return NULL;
     }
     
-    if (mv > 65535)
+    if (mv < 1 || mv > 65535)
     {
         cgError("cgReadPGMImage", "Invalid maximum value."); 
         fclose(fp);
@@ -136,69 +479,130 @@ cgMat2i cgReadPGMImage(
         fclose(fp);
         return NULL;
     }
+    img->maxval = mv;
+
+    /* Read the raster at once and decode it in parallel. */
+    long start = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp) - start;
+    fseek(fp, start, SEEK_SET);
+
+    /* A raw raster has a known size; another image may follow it. */
+    if (type == CG_IMAGE_TYPE_PGM_RAW)
+    {
+        long raster = (long) nr * nc * ((mv < 256) ? 1 : 2);
+        if (raster < size)
+        {
+            if (next != NULL)
+                *next = start + raster;
+            size = raster;
+        }
+    }
+
+    /* The raster and the chunk tables are scratch of this thread. */
+    cgArena scratch = cgScratchArena();
+    size_t mark = (scratch != NULL) ? cgArenaMark(scratch) : 0;
+
+    cgPixelJob job;
+    job.img  = img;
+    job.data = (scratch != NULL) ? (unsigned char*) cgArenaAlloc(scratch, size > 0 ? size : 1) : NULL;
+    job.size = (job.data != NULL) ? (long) fread(job.data, 1, size, fp) : 0;
+    fclose(fp);
+
+    if (job.data == NULL)
+    {
+        cgError("cgReadPGMImage", "No memory available.");
+        cgFreeMat2i(img);
+        return NULL;
+    }
 
-    /* Read pixels. */
     if (type == CG_IMAGE_TYPE_PGM_ASCII)
     {
-        for (r = 0; r < nr; r++)
+        /* Chunks start at token boundaries; a first pass counts the tokens
+         * of each chunk so the second knows where its pixels go. */
+        int chunks = 4 * cgJobsThreadCount();
+        long *bounds = (long*) cgArenaAlloc(scratch, (chunks + 1) * sizeof(long));
+        long *first = (long*) cgArenaAlloc(scratch, (chunks + 1) * sizeof(long));
+        int k;
+
+        if (bounds == NULL || first == NULL)
         {
-            for (c = 0; c < nc; c++)
+            cgError("cgReadPGMImage", "No memory available.");
+            cgArenaRewind(scratch, mark);
+            cgFreeMat2i(img);
+            return NULL;
+        }
+
+        for (k = 0; k < chunks; k++)
+            bounds[k] = job.size * k / chunks;
+        bounds[chunks] = job.size;
+
+        job.chunks = chunks;
+        job.bounds = bounds;
+        job.first  = first;
+
+        cgParallelFor2D(0, chunks, 0, 1, 1, 1, CountTokensBlock, &job, NULL);
+
+        long count = 0, n;
+        for (k = 0; k < chunks; k++)
+        {
+            n = first[k];
+            first[k] = count;
+            count += n;
+        }
+
+        cgParallelFor2D(0, chunks, 0, 1, 1, 1, ParseTokensBlock, &job, NULL);
+
+        if (count < (long) nr * nc)
+        {
+            cgError("cgReadPGMImage", "File ended prematurely.");
+            if (strict)
             {
-                if (fscanf(fp, "%d", &img->val[r][c]) == EOF)
-                {
-                    cgError("cgReadPGMImage", "File ended prematurely."); 
-                    fclose(fp);
-                    return img;
-                }
+                cgArenaRewind(scratch, mark);
+                cgFreeMat2i(img);
+                return NULL;
             }
         }
     }
     else if (type == CG_IMAGE_TYPE_PGM_RAW)
     {
-        for (r = 0; r < nr; r++)
+        job.bytes = (mv < 256) ? 1 : 2;
+
+        cgParallelFor2D(0, nr, 0, 1, 64, 1, RawRowsBlock, &job, NULL);
+
+        if (job.size < (long) nr * nc * job.bytes)
         {
-            for (c = 0; c < nc; c++)
+            cgError("cgReadPGMImage", "File ended prematurely.");
+            if (strict)
             {
-                if (mv < 256)
-                {
-                    if (fread(&b, 1, 1, fp) == 0)
-                    {
-                        cgError("cgReadPGMImage", "File ended prematurely."); 
-                        fclose(fp);
-                        return img;
-                    }
-                    img->val[r][c] = (int)b;
-                }
-                else
-                {       
-                    if (fread(&b1, 1, 1, fp) == 0)
-                    {
-                        cgError("cgReadPGMImage", "File ended prematurely."); 
-                        fclose(fp);
-                        return img;
-                    }
-                    
-                    if (fread(&b2, 1, 1, fp) == 0)
-                    {
-                        cgError("cgReadPGMImage", "File ended prematurely."); 
-                        fclose(fp);
-                        return img;
-                    }
-                    bb = 0;
-                    bb = (bb | b1) << 8;
-                    bb = (bb | b2);
-                    img->val[r][c] = (int) bb;
-                }
+                cgArenaRewind(scratch, mark);
+                cgFreeMat2i(img);
+                return NULL;
             }
         }
     }
 
-    /* Close file. */
-    fclose(fp);
+    cgArenaRewind(scratch, mark);
 
     return img;
 }
 
+cgMat2i cgReadPGMImage(
+    const char *fname
+)
+{
+    return ReadPGM(fname, 0, NULL, CG_FALSE);
+}
+
+cgMat2i cgReadPGMImageAt(
+    const char *fname,
+    long offset,
+    long *next
+)
+{
+    return ReadPGM(fname, offset, next, CG_TRUE);
+}
+
 void cgWritePGMImage(
     cgMat2i img,
     char *fname,
@@ -208,7 +612,7 @@ void cgWritePGMImage(
     int r, c;
     int b, mv;
     int vpl;
-    char str[32] = "";
+    char str[PATH_MAX + 32] = "";
 
     /* Check input. */
     if (img == NULL)
@@ -222,7 +626,7 @@ void cgWritePGMImage(
 
     if (fp == NULL)
     {
-        sprintf(str, "Unable to open file %s", fname);
+        snprintf(str, sizeof(str), "Unable to open file %s", fname);
         cgError("cgWritePGMImage", str); 
         return;
     }
@@ -237,14 +641,17 @@ void cgWritePGMImage(
     else
     {
         cgError("cgWritePGMImage", "Invalid image type."); 
+        fclose(fp);
         return;
     }
 
     /* Width and height. */
     fprintf(fp, "%d %d\n", img->width, img->height);
 
-    /* Maximum gray value. */
+    /* Maximum gray value (the format maximum, unless pixels exceed it). */
     mv =  cgMatMaxValue2i(img);
+    if (img->maxval > mv && img->maxval <= 65535)
+        mv = img->maxval;
     fprintf(fp, "%d\n", mv);
 
     /* Write pixels. */
@@ -256,12 +663,12 @@ void cgWritePGMImage(
             for (c = 0; c < img->width; c++)
             {
                 if (vpl <= 18){
-                    fprintf(fp, "%d ", (int)img->val[r][c]);
+                    fprintf(fp, "%d ", cgMatAt2i(img, r, c));
                     vpl++;
                 }
                 else
                 {
-                    fprintf(fp, "%d\n", (int)img->val[r][c]);
+                    fprintf(fp, "%d\n", cgMatAt2i(img, r, c));
                     vpl = 0;
                 }
             }
@@ -275,14 +682,14 @@ void cgWritePGMImage(
             {
                 if (mv < 256)
                 {
-                    b = img->val[r][c];
+                    b = cgMatAt2i(img, r, c);
                     fwrite(&b, 1, 1, fp);
                 }
                 else
                 {
-                    b = ((int)img->val[r][c] & 0x0000ff00) >> 8;
+                    b = (cgMatAt2i(img, r, c) & 0x0000ff00) >> 8;
                     fwrite(&b, 1, 1, fp);
-                    b = (int)img->val[r][c] & 0x000000ff;
+                    b = cgMatAt2i(img, r, c) & 0x000000ff;
                     fwrite(&b, 1, 1, fp);
                 }
             }
@@ -424,8 +831,10 @@ int ParsePGMHeader(
     }
     ungetc(c, fp);
 
-    fret = fscanf(fp, "%d\n", mv);
-    if ((fret == 0) || (fret == EOF))
+    /* A single whitespace separates the header from the raster, whose
+     * first bytes may look like whitespace too. */
+    fret = fscanf(fp, "%d", mv);
+    if ((fret == 0) || (fret == EOF) || !isspace(fgetc(fp)))
     {
         cgError("ParsePGMHeader", "Failed reading header."); 
         return CG_FALSE;
@@ -470,8 +879,6 @@ void cgFreeMat2i(
     cgMat2i mat
 )
 {
-    int r;
-
     /* Check if mat is not NULL. */
     if (mat == NULL)
     {
@@ -479,17 +886,12 @@ void cgFreeMat2i(
         return;
     }
     
-    /* Free the columns of each row. */
-    for (r = 0; r < mat->height; r++)
-    {
-        free(mat->val[r]);
-    }
-
-    /* Free rows. */
-    free(mat->val);
+    /* Return pixels and row pointers to the pool. */
+    cgPoolFree(mat->data);
+    cgPoolFree(mat->val);
 
     /* Free matrix. */
-    free(mat);
+    cgPoolFree(mat);
 }
 
 void cgError(
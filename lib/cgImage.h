@@ -24,11 +24,24 @@
 #define CG_FALSE 0
 #define CG_TRUE  1
 
+#define CG_LAYOUT_ROW_MAJOR 0
+#define CG_LAYOUT_TILED     1
+#define CG_LAYOUT_MORTON    2
+
+#define CG_LAYOUT_TILED_LOG2  4 /* 16x16 row-major tiles. */
+#define CG_LAYOUT_MORTON_LOG2 6 /* 64x64 Z-ordered tiles. */
+
 
 /* Types. */
 
 /// cgMat2i
 /** The struct represents an integer two dimensional matrix. 
+ *
+ * Pixels live in one block, data, in one of three layouts: row-major,
+ * square tiles stored one after the other (row-major inside a tile) or
+ * tiles with a Morton/Z order inside. Tiled layouts pad the matrix to whole
+ * tiles. Use cgMatAt2i or an iterator to address pixels independently of
+ * the layout; val is only available for row-major matrices.
  */
 typedef struct cg_mat_2i
 {
@@ -39,11 +52,227 @@ typedef struct cg_mat_2i
     /** The number of columns of the matrix. */
     int width;
     /// Matrix.
-    /** The integer matrix. */
+    /** Row pointers into data (row-major layout only; NULL otherwise). */
     int **val;
+    /// Layout.
+    /** CG_LAYOUT_ROW_MAJOR, CG_LAYOUT_TILED or CG_LAYOUT_MORTON. */
+    int layout;
+    /// Tile size.
+    /** Log2 of the tile side (0 for row-major). */
+    int tileLog2;
+    /// Tiles per row.
+    /** Number of tile columns (0 for row-major). */
+    int tilesX;
+    /// Pixels.
+    /** All pixels in storage order. */
+    int *data;
+    /// Maximum value.
+    /** Maximum value of the pixel format (the PGM maxval; 255 for new
+     * matrices). Intensities are normalized by it for display. */
+    int maxval;
 
 } *cgMat2i;
 
+/// cgMatIter2i
+/** Iterator over a region of a matrix in storage order.
+ */
+typedef struct cg_mat_iter_2i
+{
+    /// Matrix.
+    /** The matrix being traversed. */
+    cgMat2i mat;
+    /// Region.
+    /** Rows [r0, r1) and columns [c0, c1). */
+    int r0, r1, c0, c1;
+    /// Current tile.
+    /** Origin of the current tile. */
+    int tr, tc;
+    /// Index in tile.
+    /** Storage index inside the current tile. */
+    int i;
+    /// Current pixel.
+    /** Row and column of the current pixel. */
+    int r, c;
+    /// Current value.
+    /** Pointer to the current pixel. */
+    int *ptr;
+
+} cgMatIter2i;
+
+
+/* Addressing. */
+
+/// Spread bits.
+/**
+ * This function inserts a zero bit between the 16 low bits of a value.
+ * @param x value.
+ * @return spread value.
+ */
+static inline unsigned int cgSpreadBits(
+    unsigned int x
+)
+{
+    x &= 0x0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+/// Compact bits.
+/**
+ * This function takes the even bits of a value (inverse of cgSpreadBits).
+ * @param x value.
+ * @return compacted value.
+ */
+static inline unsigned int cgCompactBits(
+    unsigned int x
+)
+{
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0f0f0f0f;
+    x = (x | (x >> 4)) & 0x00ff00ff;
+    x = (x | (x >> 8)) & 0x0000ffff;
+    return x;
+}
+
+/// Pixel index.
+/**
+ * This function returns the position of a pixel in the data block.
+ * @param mat matrix.
+ * @param r row.
+ * @param c column.
+ * @return index in mat->data.
+ */
+static inline size_t cgMatIndex2i(
+    const struct cg_mat_2i *mat,
+    int r,
+    int c
+)
+{
+    int s = mat->tileLog2;
+    int m = (1 << s) - 1;
+    size_t tile = ((size_t) (r >> s) * mat->tilesX + (c >> s)) << (2 * s);
+
+    switch (mat->layout)
+    {
+        case CG_LAYOUT_TILED:
+            return tile + ((r & m) << s) + (c & m);
+        case CG_LAYOUT_MORTON:
+            return tile + ((cgSpreadBits(r & m) << 1) | cgSpreadBits(c & m));
+        default:
+            return (size_t) r * mat->width + c;
+    }
+}
+
+/// Pixel access.
+/** Pixel (r, c) of a matrix as an lvalue, for any layout. */
+#define cgMatAt2i(mat, r, c) ((mat)->data[cgMatIndex2i((mat), (r), (c))])
+
+/// Start iterator.
+/**
+ * This function starts an iteration over a region of a matrix. Pixels are
+ * visited in storage order: tile by tile, and inside each tile in the
+ * order of the layout.
+ * @param it iterator.
+ * @param mat matrix.
+ * @param r0 first row.
+ * @param r1 last row (exclusive).
+ * @param c0 first column.
+ * @param c1 last column (exclusive).
+ */
+static inline void cgMatIterBegin2i(
+    cgMatIter2i *it,
+    cgMat2i mat,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    int m = (1 << mat->tileLog2) - 1;
+
+    it->mat = mat;
+    it->r0 = r0;
+    it->r1 = r1;
+    it->c0 = c0;
+    it->c1 = c1;
+    it->tr = r0 & ~m;
+    it->tc = c0 & ~m;
+    it->i  = -1;
+    it->r  = r0;
+    it->c  = c0 - 1;
+    it->ptr = NULL;
+}
+
+/// Advance iterator.
+/**
+ * This function moves an iterator to the next pixel of its region.
+ * @param it iterator.
+ * @return 1 while there are pixels (it->r, it->c and it->ptr are set).
+ */
+static inline int cgMatIterNext2i(
+    cgMatIter2i *it
+)
+{
+    cgMat2i mat = it->mat;
+    int s = mat->tileLog2;
+    int n = 1 << (2 * s);
+
+    if (it->r0 >= it->r1 || it->c0 >= it->c1)
+        return 0;
+
+    if (mat->layout == CG_LAYOUT_ROW_MAJOR)
+    {
+        if (++it->c == it->c1)
+        {
+            it->c = it->c0;
+            it->r++;
+        }
+        if (it->r >= it->r1)
+            return 0;
+        it->ptr = mat->data + (size_t) it->r * mat->width + it->c;
+        return 1;
+    }
+
+    for (;;)
+    {
+        if (++it->i == n)
+        {
+            /* Next tile of the region. */
+            it->i = 0;
+            it->tc += 1 << s;
+            if (it->tc >= it->c1)
+            {
+                it->tc = it->c0 & ~((1 << s) - 1);
+                it->tr += 1 << s;
+                if (it->tr >= it->r1)
+                    return 0;
+            }
+        }
+
+        if (mat->layout == CG_LAYOUT_TILED)
+        {
+            it->r = it->tr + (it->i >> s);
+            it->c = it->tc + (it->i & ((1 << s) - 1));
+        }
+        else
+        {
+            it->r = it->tr + cgCompactBits(it->i >> 1);
+            it->c = it->tc + cgCompactBits(it->i);
+        }
+
+        if (it->r >= it->r0 && it->r < it->r1 && it->c >= it->c0 && it->c < it->c1)
+        {
+            it->ptr = mat->data +
+                      (((size_t) (it->tr >> s) * mat->tilesX + (it->tc >> s)) << (2 * s)) + it->i;
+            return 1;
+        }
+    }
+}
+
 /* Functions. */
 
 /// Allocate integer 2D matrix.
@@ -58,6 +287,79 @@ cgMat2i cgAllocateMat2i(
     int width
 );
 
+/// Allocate integer 2D matrix with layout.
+/**
+ * This function allocates an integer two dimensional matrix with a given
+ * memory layout. Pixels are set to zero.
+ * @param height number of rows.
+ * @param width number of columns.
+ * @param layout CG_LAYOUT_ROW_MAJOR, CG_LAYOUT_TILED or CG_LAYOUT_MORTON.
+ * @return matrix or NULL (in case of error).
+ */
+cgMat2i cgAllocateMat2iLayout(
+    int height,
+    int width,
+    int layout
+);
+
+/// Convert matrix layout.
+/**
+ * This function copies a matrix into a new matrix with another layout.
+ * @param mat matrix.
+ * @param layout layout of the copy.
+ * @return copy or NULL (in case of error).
+ */
+cgMat2i cgConvertLayout2i(
+    cgMat2i mat,
+    int layout
+);
+
+/// Storage size.
+/**
+ * This function returns the number of ints in the data block of a matrix,
+ * including the padding of tiled layouts.
+ * @param mat matrix.
+ * @return number of ints.
+ */
+size_t cgMatStorage2i(
+    cgMat2i mat
+);
+
+/// Read row segment.
+/**
+ * This function copies the pixels [c0, c1) of a row to a buffer, walking
+ * the layout tile by tile instead of addressing each pixel.
+ * @param mat matrix.
+ * @param r row.
+ * @param c0 first column.
+ * @param c1 last column (exclusive).
+ * @param out buffer with c1 - c0 ints.
+ */
+void cgMatGetRow2i(
+    cgMat2i mat,
+    int r,
+    int c0,
+    int c1,
+    int *out
+);
+
+/// Write row segment.
+/**
+ * This function copies a buffer to the pixels [c0, c1) of a row.
+ * @param mat matrix.
+ * @param r row.
+ * @param c0 first column.
+ * @param c1 last column (exclusive).
+ * @param in buffer with c1 - c0 ints.
+ */
+void cgMatSetRow2i(
+    cgMat2i mat,
+    int r,
+    int c0,
+    int c1,
+    const int *in
+);
+
 /// Free integer 2D matrix.
 /**
  * This function frees an integer two dimensional matrix.
@@ -89,7 +391,8 @@ int cgMatMinValue2i(
 
 /// Read PGM image.
 /**
- * This function reads an image from a PGM file.
+ * This function reads an image from a PGM file. A file that ends early
+ * gives the pixels read so far.
  * @param fname pgm file name.
  * @return gray-tone image or NULL in error.
  */
@@ -97,6 +400,23 @@ cgMat2i cgReadPGMImage(
     const char *fname
 );
 
+/// Read PGM image at offset.
+/**
+ * This function reads the image that starts at a byte offset of a PGM
+ * file. Raw PGM files may hold several images one after the other. A
+ * raster that ends early is an error.
+ * @param fname pgm file name.
+ * @param offset offset of the image header.
+ * @param next returned offset of the next image, or -1 if none (may be
+ * NULL).
+ * @return gray-tone image or NULL in error.
+ */
+cgMat2i cgReadPGMImageAt(
+    const char *fname,
+    long offset,
+    long *next
+);
+
 /// Write PGM image.
 /**
  * This function writes an image to a PGM file.
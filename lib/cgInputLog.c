@@ -0,0 +1,195 @@
+/**
+ * @file cgInputLog.c
+ * @brief Implementation of the input log functions.
+ */
+
+
+#include "cgInputLog.h"
+
+
+/* File magic and version. */
+#define INPUT_LOG_MAGIC   "CGIN"
+#define INPUT_LOG_VERSION 1
+
+
+/* Unsigned LEB128: seven bits per byte, high bit set on all but the last. */
+static int WriteVarint(
+    FILE *fp,
+    uint64_t v
+)
+{
+    unsigned char buf[10];
+    int n = 0;
+
+    do
+    {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if (v != 0)
+            buf[n] |= 0x80;
+        n++;
+    }
+    while (v != 0);
+
+    return fwrite(buf, 1, n, fp) == (size_t) n;
+}
+
+static int ReadVarint(
+    FILE *fp,
+    uint64_t *v
+)
+{
+    int c, shift = 0;
+
+    *v = 0;
+    do
+    {
+        if ((c = fgetc(fp)) == EOF || shift > 63)
+            return CG_FALSE;
+        *v |= (uint64_t) (c & 0x7f) << shift;
+        shift += 7;
+    }
+    while (c & 0x80);
+
+    return CG_TRUE;
+}
+
+cgInputLog cgCreateInputLog(
+    const char *fname
+)
+{
+    cgInputLog log = (cgInputLog) malloc(sizeof(struct cg_input_log));
+    if (log == NULL)
+    {
+        cgError("cgCreateInputLog", "No memory available.");
+        return NULL;
+    }
+
+    log->fp = fopen(fname, "wb");
+    if (log->fp == NULL)
+    {
+        char str[PATH_MAX + 32];
+        snprintf(str, sizeof(str), "Unable to open file %s", fname);
+        cgError("cgCreateInputLog", str);
+        free(log);
+        return NULL;
+    }
+    log->last = 0;
+
+    fwrite(INPUT_LOG_MAGIC, 1, 4, log->fp);
+    fputc(INPUT_LOG_VERSION, log->fp);
+
+    return log;
+}
+
+int cgRecordInput(
+    cgInputLog log,
+    const cgInputEvent *event
+)
+{
+    int ok;
+
+    if (event->time < log->last)
+    {
+        cgError("cgRecordInput", "Events out of order.");
+        return CG_FALSE;
+    }
+
+    ok = WriteVarint(log->fp, event->time - log->last) && fputc(event->type, log->fp) != EOF;
+    if (event->type == CG_INPUT_KEY)
+        ok = ok && fputc(event->key, log->fp) != EOF;
+    else
+        ok = ok && WriteVarint(log->fp, event->width) && WriteVarint(log->fp, event->height);
+    log->last = event->time;
+
+    return ok && fflush(log->fp) == 0;
+}
+
+void cgCloseInputLog(
+    cgInputLog log
+)
+{
+    if (log == NULL)
+        return;
+
+    fclose(log->fp);
+    free(log);
+}
+
+cgInputEvent *cgReadInputLog(
+    const char *fname,
+    int *count
+)
+{
+    char magic[4];
+    cgInputEvent *events = NULL, e;
+    uint64_t delta, time = 0, w, h;
+    int n = 0, capacity = 0, type, key;
+
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL)
+    {
+        char str[PATH_MAX + 32];
+        snprintf(str, sizeof(str), "Unable to open file %s", fname);
+        cgError("cgReadInputLog", str);
+        return NULL;
+    }
+
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, INPUT_LOG_MAGIC, 4) != 0 ||
+        fgetc(fp) != INPUT_LOG_VERSION)
+    {
+        cgError("cgReadInputLog", "Invalid input log.");
+        fclose(fp);
+        return NULL;
+    }
+
+    while (ReadVarint(fp, &delta) && (type = fgetc(fp)) != EOF)
+    {
+        memset(&e, 0, sizeof(e));
+        time += delta;
+        e.time = time;
+        e.type = type;
+
+        if (type == CG_INPUT_KEY)
+        {
+            if ((key = fgetc(fp)) == EOF)
+                break;
+            e.key = key;
+        }
+        else if (type == CG_INPUT_RESHAPE)
+        {
+            if (!ReadVarint(fp, &w) || !ReadVarint(fp, &h))
+                break;
+            e.width = (int) w;
+            e.height = (int) h;
+        }
+        else
+        {
+            cgError("cgReadInputLog", "Unknown event type.");
+            break;
+        }
+
+        if (n == capacity)
+        {
+            int grown = (capacity > 0) ? 2 * capacity : 256;
+            cgInputEvent *p = (cgInputEvent*) realloc(events, grown * sizeof(cgInputEvent));
+            if (p == NULL)
+            {
+                cgError("cgReadInputLog", "No memory available.");
+                break;
+            }
+            events = p;
+            capacity = grown;
+        }
+        events[n++] = e;
+    }
+
+    fclose(fp);
+
+    /* An empty log is valid. */
+    if (events == NULL)
+        events = (cgInputEvent*) malloc(sizeof(cgInputEvent));
+    *count = n;
+
+    return events;
+}
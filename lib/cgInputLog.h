@@ -0,0 +1,110 @@
+/**
+ * @file cgInputLog.h
+ * @brief Declaration of the input log functions.
+ *
+ * An input log keeps the events of an interactive session with their times,
+ * so the session can be replayed. Events are stored as a variable length
+ * time delta in microseconds, a type byte and a small payload (the key, or
+ * the new window size): a key press a second after the last event takes
+ * five bytes.
+ */
+
+
+#ifndef _CGINPUTLOG_H_
+#define _CGINPUTLOG_H_
+
+
+/* Includes. */
+#include <stdint.h>
+#include "cgImage.h"
+
+
+/* Defines. */
+#define CG_INPUT_KEY     1
+#define CG_INPUT_RESHAPE 2
+
+
+/* Types. */
+
+/// cgInputEvent
+/** An input event.
+ */
+typedef struct cg_input_event
+{
+    /// Time.
+    /** Microseconds since the start of the session. */
+    uint64_t time;
+    /// Type.
+    /** CG_INPUT_KEY or CG_INPUT_RESHAPE. */
+    int type;
+    /// Key.
+    /** Key of CG_INPUT_KEY. */
+    int key;
+    /// Size.
+    /** Window size of CG_INPUT_RESHAPE. */
+    int width, height;
+
+} cgInputEvent;
+
+/// cgInputLog
+/** An input log open for writing.
+ */
+typedef struct cg_input_log
+{
+    /// File.
+    FILE *fp;
+    /// Last time.
+    /** Time of the last event written. */
+    uint64_t last;
+
+} *cgInputLog;
+
+
+/* Functions. */
+
+/// Create input log.
+/**
+ * This function creates an input log file.
+ * @param fname file name.
+ * @return log or NULL in error.
+ */
+cgInputLog cgCreateInputLog(
+    const char *fname
+);
+
+/// Record input event.
+/**
+ * This function appends an event to a log. Events must come in time order;
+ * each one is flushed so a session that crashes keeps its events.
+ * @param log log.
+ * @param event event.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgRecordInput(
+    cgInputLog log,
+    const cgInputEvent *event
+);
+
+/// Close input log.
+/**
+ * This function closes a log.
+ * @param log log.
+ */
+void cgCloseInputLog(
+    cgInputLog log
+);
+
+/// Read input log.
+/**
+ * This function reads all events of a log. A truncated last event is
+ * dropped.
+ * @param fname file name.
+ * @param count returned number of events.
+ * @return events (free with free) or NULL in error.
+ */
+cgInputEvent *cgReadInputLog(
+    const char *fname,
+    int *count
+);
+
+#endif /* _CGINPUTLOG_H_ */
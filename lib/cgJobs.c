@@ -0,0 +1,389 @@
+/**
+ * @file cgJobs.c
+ * @brief Implementation of the job system.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "cgJobs.h"
+
+
+/* A task is stored by value in the deques. Range tasks carry their block
+ * and grain so splitting them needs no allocation. */
+typedef struct cg_task
+{
+    cgTaskGroup *group;
+    cgTaskGroup *cancel;
+    cgTaskFunc   func;
+    cgRangeFunc  range;
+    void        *arg;
+    int          block[4];
+    int          grain[2];
+
+} cgTask;
+
+/* Deque of tasks in a growable ring. The owner works at the tail, thieves
+ * take from the head. */
+typedef struct cg_deque
+{
+    pthread_mutex_t lock;
+    cgTask *items;
+    long head;
+    long tail;
+    long capacity;
+
+} cgDeque;
+
+/* The pool: one deque per worker plus a shared one for outside threads. */
+static struct
+{
+    int threads;
+    int queues;
+    cgDeque *deques;
+    pthread_mutex_t sleepLock;
+    pthread_cond_t wake;
+    volatile int queued;
+
+} pool;
+
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static __thread int selfQueue = -1;
+
+
+static void DequePush(
+    cgDeque *dq,
+    const cgTask *task
+)
+{
+    long i, n;
+
+    pthread_mutex_lock(&dq->lock);
+
+    /* Grow the ring, keeping the order of the tasks. */
+    if (dq->tail - dq->head == dq->capacity)
+    {
+        n = dq->capacity * 2;
+        cgTask *items = (cgTask*) malloc(n * sizeof(cgTask));
+        if (items == NULL)
+        {
+            fprintf(stderr, "\ncgJobs:No memory available.\n");
+            abort();
+        }
+        for (i = dq->head; i < dq->tail; i++)
+            items[i % n] = dq->items[i % dq->capacity];
+        free(dq->items);
+        dq->items = items;
+        dq->capacity = n;
+    }
+
+    dq->items[dq->tail % dq->capacity] = *task;
+    dq->tail++;
+
+    pthread_mutex_unlock(&dq->lock);
+}
+
+static int DequeTake(
+    cgDeque *dq,
+    int fromTail,
+    cgTask *task
+)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+
+    if (dq->tail > dq->head)
+    {
+        if (fromTail)
+            *task = dq->items[--dq->tail % dq->capacity];
+        else
+            *task = dq->items[dq->head++ % dq->capacity];
+        found = 1;
+    }
+
+    pthread_mutex_unlock(&dq->lock);
+
+    return found;
+}
+
+static void Push(
+    const cgTask *task
+)
+{
+    int q = (selfQueue >= 0) ? selfQueue : pool.queues - 1;
+
+    DequePush(&pool.deques[q], task);
+    __atomic_add_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&pool.sleepLock);
+    pthread_cond_signal(&pool.wake);
+    pthread_mutex_unlock(&pool.sleepLock);
+}
+
+static int TryTake(
+    cgTask *task
+)
+{
+    int self = (selfQueue >= 0) ? selfQueue : pool.queues - 1;
+    int i, q;
+
+    if (__atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST) == 0)
+        return 0;
+
+    /* Own work first (most recent, still in cache), then steal the oldest
+     * work of the others, which tends to be the largest. */
+    for (i = 0; i < pool.queues; i++)
+    {
+        q = (self + i) % pool.queues;
+        if (DequeTake(&pool.deques[q], q == self, task))
+        {
+            __atomic_sub_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void RunRange(
+    cgTask *task
+)
+{
+    cgTask half;
+    int *b = task->block;
+    int mid;
+
+    /* Split off halves until the block fits the grain. */
+    while ((b[1] - b[0] > task->grain[0]) || (b[3] - b[2] > task->grain[1]))
+    {
+        if (cgTaskGroupCancelled(task->cancel))
+            return;
+
+        half = *task;
+        if ((long) (b[1] - b[0]) * task->grain[1] >= (long) (b[3] - b[2]) * task->grain[0])
+        {
+            mid = b[0] + (b[1] - b[0]) / 2;
+            half.block[0] = mid;
+            b[1] = mid;
+        }
+        else
+        {
+            mid = b[2] + (b[3] - b[2]) / 2;
+            half.block[2] = mid;
+            b[3] = mid;
+        }
+
+        __atomic_add_fetch(&task->group->pending, 1, __ATOMIC_SEQ_CST);
+        Push(&half);
+    }
+
+    task->range(task->arg, b[0], b[1], b[2], b[3]);
+}
+
+static void Execute(
+    cgTask *task
+)
+{
+    if (!cgTaskGroupCancelled(task->group) && !cgTaskGroupCancelled(task->cancel))
+    {
+        if (task->range != NULL)
+            RunRange(task);
+        else
+            task->func(task->arg);
+    }
+
+    __atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_SEQ_CST);
+}
+
+static void *WorkerMain(
+    void *arg
+)
+{
+    cgTask task;
+
+    selfQueue = (int) (long) arg;
+
+    for (;;)
+    {
+        if (TryTake(&task))
+        {
+            Execute(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.sleepLock);
+        while (__atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST) == 0)
+            pthread_cond_wait(&pool.wake, &pool.sleepLock);
+        pthread_mutex_unlock(&pool.sleepLock);
+    }
+
+    return NULL;
+}
+
+static void StartPool(
+    void
+)
+{
+    pthread_t thread;
+    const char *env;
+    int i;
+
+    pool.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if ((env = getenv("CG_NUM_THREADS")) != NULL && atoi(env) > 0)
+        pool.threads = atoi(env);
+    if (pool.threads < 1)
+        pool.threads = 1;
+
+    /* Workers plus the shared deque of outside threads. */
+    pool.queues = pool.threads;
+    pool.deques = (cgDeque*) calloc(pool.queues, sizeof(cgDeque));
+    if (pool.deques == NULL)
+    {
+        fprintf(stderr, "\ncgJobs:No memory available.\n");
+        abort();
+    }
+
+    for (i = 0; i < pool.queues; i++)
+    {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].capacity = 64;
+        pool.deques[i].items = (cgTask*) malloc(64 * sizeof(cgTask));
+    }
+
+    pthread_mutex_init(&pool.sleepLock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+
+    /* The waiting thread runs tasks too, so one thread less is started. */
+    for (i = 0; i < pool.threads - 1; i++)
+    {
+        if (pthread_create(&thread, NULL, WorkerMain, (void*) (long) i) == 0)
+            pthread_detach(thread);
+    }
+}
+
+int cgJobsThreadCount(
+    void
+)
+{
+    pthread_once(&poolOnce, StartPool);
+
+    return pool.threads;
+}
+
+void cgTaskGroupInit(
+    cgTaskGroup *group
+)
+{
+    group->pending = 0;
+    group->cancelled = 0;
+}
+
+void cgTaskGroupRun(
+    cgTaskGroup *group,
+    cgTaskFunc func,
+    void *arg
+)
+{
+    cgTask task;
+
+    pthread_once(&poolOnce, StartPool);
+
+    memset(&task, 0, sizeof(task));
+    task.group = group;
+    task.func  = func;
+    task.arg   = arg;
+
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
+    Push(&task);
+}
+
+void cgTaskGroupWait(
+    cgTaskGroup *group
+)
+{
+    cgTask task;
+
+    pthread_once(&poolOnce, StartPool);
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0)
+    {
+        if (TryTake(&task))
+            Execute(&task);
+        else
+            sched_yield();
+    }
+}
+
+int cgJobsRunPending(
+    void
+)
+{
+    cgTask task;
+
+    pthread_once(&poolOnce, StartPool);
+
+    if (!TryTake(&task))
+        return 0;
+
+    Execute(&task);
+
+    return 1;
+}
+
+void cgTaskGroupCancel(
+    cgTaskGroup *group
+)
+{
+    __atomic_store_n(&group->cancelled, 1, __ATOMIC_SEQ_CST);
+}
+
+int cgTaskGroupCancelled(
+    const cgTaskGroup *group
+)
+{
+    return (group != NULL) && __atomic_load_n(&group->cancelled, __ATOMIC_SEQ_CST);
+}
+
+void cgParallelFor2D(
+    int r0,
+    int r1,
+    int c0,
+    int c1,
+    int grainR,
+    int grainC,
+    cgRangeFunc func,
+    void *arg,
+    cgTaskGroup *group
+)
+{
+    cgTaskGroup local;
+    cgTask root;
+
+    if (r1 <= r0 || c1 <= c0)
+        return;
+
+    pthread_once(&poolOnce, StartPool);
+    cgTaskGroupInit(&local);
+
+    memset(&root, 0, sizeof(root));
+    root.group    = &local;
+    root.cancel   = group;
+    root.range    = func;
+    root.arg      = arg;
+    root.block[0] = r0;
+    root.block[1] = r1;
+    root.block[2] = c0;
+    root.block[3] = c1;
+    root.grain[0] = (grainR > 0) ? grainR : 1;
+    root.grain[1] = (grainC > 0) ? grainC : 1;
+
+    /* The caller starts on the root block and then helps with the rest. */
+    local.pending = 1;
+    Execute(&root);
+    cgTaskGroupWait(&local);
+}
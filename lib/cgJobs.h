@@ -0,0 +1,150 @@
+/**
+ * @file cgJobs.h
+ * @brief Declaration of the job system.
+ *
+ * A single work-stealing thread pool is shared by the loaders, the mesher
+ * and the image kernels. Each worker owns a deque: it pushes and pops work
+ * at the bottom while idle workers steal from the top of the others. A
+ * thread waiting on a task group runs pending tasks instead of blocking, so
+ * parallel loops may be nested without deadlock or extra threads.
+ *
+ * The pool is created on first use with one thread per hardware thread
+ * (the waiting thread counts as one). The environment variable
+ * CG_NUM_THREADS overrides the count; 1 runs everything on the caller.
+ */
+
+
+#ifndef _CGJOBS_H_
+#define _CGJOBS_H_
+
+
+/* Types. */
+
+/// cgTaskGroup
+/** A set of tasks that can be waited on and cancelled together.
+ */
+typedef struct cg_task_group
+{
+    /// Pending tasks.
+    /** Number of tasks submitted and not finished yet. */
+    volatile int pending;
+    /// Cancelled flag.
+    /** Tasks of a cancelled group that have not started are skipped. */
+    volatile int cancelled;
+
+} cgTaskGroup;
+
+/// Task function.
+/** Function run by cgTaskGroupRun. */
+typedef void (*cgTaskFunc)(void *arg);
+
+/// Range function.
+/** Function run by cgParallelFor2D on the rows [r0, r1) and columns
+ * [c0, c1) of a block. */
+typedef void (*cgRangeFunc)(void *arg, int r0, int r1, int c0, int c1);
+
+
+/* Functions. */
+
+/// Number of threads.
+/**
+ * This function returns the number of threads running tasks, including the
+ * waiting thread. It starts the pool if needed.
+ * @return number of threads.
+ */
+int cgJobsThreadCount(
+    void
+);
+
+/// Initialize task group.
+/**
+ * This function initializes an empty task group.
+ * @param group task group.
+ */
+void cgTaskGroupInit(
+    cgTaskGroup *group
+);
+
+/// Run task.
+/**
+ * This function submits a task to a group.
+ * @param group task group.
+ * @param func task function.
+ * @param arg task argument.
+ */
+void cgTaskGroupRun(
+    cgTaskGroup *group,
+    cgTaskFunc func,
+    void *arg
+);
+
+/// Wait for task group.
+/**
+ * This function returns when all tasks of a group are done. The calling
+ * thread executes pending tasks meanwhile.
+ * @param group task group.
+ */
+void cgTaskGroupWait(
+    cgTaskGroup *group
+);
+
+/// Run pending task.
+/**
+ * This function runs one queued task, if any, on the calling thread. It
+ * lets a thread that waits on something other than a task group keep
+ * helping the pool.
+ * @return 1 if a task was run; 0 otherwise.
+ */
+int cgJobsRunPending(
+    void
+);
+
+/// Cancel task group.
+/**
+ * This function cancels a group: tasks that have not started are skipped.
+ * Running tasks may poll cgTaskGroupCancelled to stop early.
+ * @param group task group.
+ */
+void cgTaskGroupCancel(
+    cgTaskGroup *group
+);
+
+/// Check cancellation.
+/**
+ * This function tells whether a group was cancelled.
+ * @param group task group (may be NULL).
+ * @return 1 if cancelled; 0 otherwise.
+ */
+int cgTaskGroupCancelled(
+    const cgTaskGroup *group
+);
+
+/// Parallel 2D loop.
+/**
+ * This function runs func over the range [r0, r1) x [c0, c1). The range is
+ * split recursively in halves until blocks are at most grainR x grainC;
+ * halves are left for other workers to steal. The call returns when the
+ * whole range is done or, if group is cancelled, when running blocks finish.
+ * @param r0 first row.
+ * @param r1 last row (exclusive).
+ * @param c0 first column.
+ * @param c1 last column (exclusive).
+ * @param grainR maximum number of rows of a block.
+ * @param grainC maximum number of columns of a block.
+ * @param func block function.
+ * @param arg block function argument.
+ * @param group task group for cancellation (may be NULL).
+ */
+void cgParallelFor2D(
+    int r0,
+    int r1,
+    int c0,
+    int c1,
+    int grainR,
+    int grainC,
+    cgRangeFunc func,
+    void *arg,
+    cgTaskGroup *group
+);
+
+#endif /* _CGJOBS_H_ */
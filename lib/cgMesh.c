@@ -0,0 +1,822 @@
+/**
+ * @file cgMesh.c
+ * @brief Implementation of the mesh generation functions.
+ */
+
+
+#include <math.h>
+#include "cgMesh.h"
+#include "cgJobs.h"
+#include "cgPool.h"
+
+
+/* Rows per parallel block. */
+#define MESH_GRAIN_ROWS 16
+
+/* Rows per block of the point cloud compaction. */
+#define POINT_BLOCK_ROWS 64
+
+
+typedef struct cg_flat_mesh_job
+{
+    cgMat2i img;
+    cgFlatVertex *vertices;
+
+} cgFlatMeshJob;
+
+typedef struct cg_height_mesh_job
+{
+    cgMat2i img;
+    cgHeightVertex *vertices;
+    float scale;
+
+} cgHeightMeshJob;
+
+typedef struct cg_height_index_job
+{
+    uint32_t *indices;
+    int width;
+
+} cgHeightIndexJob;
+
+typedef struct cg_update_job
+{
+    cgMat2i img;
+    cgMat2i next;
+    cgFlatVertex *vertices;
+    unsigned char *dirty;
+    int tilesX;
+
+} cgUpdateJob;
+
+typedef struct cg_point_job
+{
+    cgMat2i img;
+    const cgPointFilter *filter;
+    uint32_t limit;
+    size_t *first;
+    cgFlatVertex *vertices;
+    int failed;
+
+} cgPointJob;
+
+
+static int MeshGrainRows(
+    cgMat2i img
+)
+{
+    int tile = 1 << img->tileLog2;
+
+    return (tile > MESH_GRAIN_ROWS) ? tile : MESH_GRAIN_ROWS;
+}
+
+float cgMapRow2Y(
+    int r,
+    int h
+)
+{
+    return (((h - 1.0f - r) / (h - 1.0f)) * 2.0f - 1.0f);
+}
+
+float cgMapColumn2X(
+    int c,
+    int w
+)
+{
+    return ((c / (w - 1.0f)) * 2.0f - 1.0f);
+}
+
+static cgFlatVertex *AddVertex(
+    cgFlatVertex *v,
+    float x,
+    float y,
+    uint16_t value
+)
+{
+    v->x = x;
+    v->y = y;
+    v->value = value;
+    v->pad = 0;
+
+    return v + 1;
+}
+
+void cgBuildFlatMeshRegion(
+    cgMat2i img,
+    cgFlatVertex *vertices,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgMatIter2i it;
+    float scale = 65535.0f / img->maxval;
+    int r, c;
+
+    /* Other layouts are read in storage order; the vertices stay in
+     * row-major order, one slot per pixel. */
+    if (img->layout != CG_LAYOUT_ROW_MAJOR)
+    {
+        cgMatIterBegin2i(&it, img, r0, r1, c0, c1);
+        while (cgMatIterNext2i(&it))
+        {
+            cgFlatVertex *v = vertices + ((size_t) it.r * img->width + it.c) * CG_MESH_FLAT_VERTICES;
+            float x0 = cgMapColumn2X(it.c, img->width + 1);
+            float x1 = cgMapColumn2X(it.c + 1, img->width + 1);
+            float y0 = cgMapRow2Y(it.r, img->height + 1);
+            float y1 = cgMapRow2Y(it.r + 1, img->height + 1);
+            uint16_t value = cgMeshValue(*it.ptr, scale);
+
+            v = AddVertex(v, x0, y0, value);
+            v = AddVertex(v, x0, y1, value);
+            v = AddVertex(v, x1, y0, value);
+            v = AddVertex(v, x0, y1, value);
+            v = AddVertex(v, x1, y1, value);
+            v = AddVertex(v, x1, y0, value);
+        }
+        return;
+    }
+
+    for (r = r0; r < r1; r++)
+    {
+        float y0 = cgMapRow2Y(r, img->height + 1);
+        float y1 = cgMapRow2Y(r + 1, img->height + 1);
+        cgFlatVertex *v = vertices + ((size_t) r * img->width + c0) * CG_MESH_FLAT_VERTICES;
+
+        for (c = c0; c < c1; c++)
+        {
+            float x0 = cgMapColumn2X(c, img->width + 1);
+            float x1 = cgMapColumn2X(c + 1, img->width + 1);
+            uint16_t value = cgMeshValue(img->val[r][c], scale);
+
+            /* First triangle. */
+            v = AddVertex(v, x0, y0, value);
+            v = AddVertex(v, x0, y1, value);
+            v = AddVertex(v, x1, y0, value);
+
+            /* Second triangle. */
+            v = AddVertex(v, x0, y1, value);
+            v = AddVertex(v, x1, y1, value);
+            v = AddVertex(v, x1, y0, value);
+        }
+    }
+}
+
+static void FlatMeshBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgFlatMeshJob *job = (cgFlatMeshJob*) arg;
+
+    cgBuildFlatMeshRegion(job->img, job->vertices, r0, r1, c0, c1);
+}
+
+cgFlatVertex *cgBuildFlatMesh(
+    cgMat2i img,
+    cgFlatVertex *vertices
+)
+{
+    cgFlatMeshJob job;
+
+    if (img == NULL)
+    {
+        cgError("cgBuildFlatMesh", "NULL image.");
+        return NULL;
+    }
+
+    if (vertices == NULL)
+    {
+        vertices = (cgFlatVertex*) cgPoolAlloc((size_t) img->height * img->width * CG_MESH_FLAT_VERTICES * sizeof(cgFlatVertex));
+        if (vertices == NULL)
+        {
+            cgError("cgBuildFlatMesh", "No memory available.");
+            return NULL;
+        }
+    }
+
+    /* Every pixel owns a fixed slice of the buffer, so blocks of rows are
+     * independent. Blocks are whole bands of tiles for tiled layouts. */
+    job.img = img;
+    job.vertices = vertices;
+    cgParallelFor2D(0, img->height, 0, img->width, MeshGrainRows(img), img->width,
+                    FlatMeshBlock, &job, NULL);
+
+    return vertices;
+}
+
+/* Tiled layouts: each storage tile is contiguous and compared at once. */
+static void UpdateTiles(
+    cgUpdateJob *job,
+    int r0,
+    int r1
+)
+{
+    cgMat2i img = job->img;
+    int s = img->tileLog2;
+    int n = 1 << (2 * s);
+    int tr, tc, te, re, r, t;
+
+    /* Blocks need not be tile aligned: a tile belongs to the block that
+     * holds its first row. */
+    for (tr = (r0 + (1 << s) - 1) & ~((1 << s) - 1); tr < r1; tr += 1 << s)
+    {
+        for (tc = 0; tc < img->width; tc += 1 << s)
+        {
+            size_t base = cgMatIndex2i(img, tr, tc);
+
+            if (memcmp(img->data + base, job->next->data + base, n * sizeof(int)) == 0)
+                continue;
+
+            memcpy(img->data + base, job->next->data + base, n * sizeof(int));
+
+            re = (tr + (1 << s) < img->height) ? tr + (1 << s) : img->height;
+            te = (tc + (1 << s) < img->width) ? tc + (1 << s) : img->width;
+            cgBuildFlatMeshRegion(img, job->vertices, tr, re, tc, te);
+
+            for (r = tr; r < re; r++)
+                for (t = tc / CG_MESH_DIRTY_TILE; t <= (te - 1) / CG_MESH_DIRTY_TILE; t++)
+                    job->dirty[(size_t) r * job->tilesX + t] = 1;
+        }
+    }
+}
+
+static void UpdateBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgUpdateJob *job = (cgUpdateJob*) arg;
+    int w = job->img->width;
+    int r, t, cs, ce;
+
+    (void) c0;
+    (void) c1;
+
+    if (job->img->layout != CG_LAYOUT_ROW_MAJOR)
+    {
+        UpdateTiles(job, r0, r1);
+        return;
+    }
+
+    for (r = r0; r < r1; r++)
+    {
+        /* Unchanged rows are skipped with a single compare. */
+        if (memcmp(job->img->val[r], job->next->val[r], w * sizeof(int)) == 0)
+            continue;
+
+        for (t = 0; t < job->tilesX; t++)
+        {
+            cs = t * CG_MESH_DIRTY_TILE;
+            ce = (cs + CG_MESH_DIRTY_TILE < w) ? cs + CG_MESH_DIRTY_TILE : w;
+
+            if (memcmp(job->img->val[r] + cs, job->next->val[r] + cs, (ce - cs) * sizeof(int)) == 0)
+                continue;
+
+            memcpy(job->img->val[r] + cs, job->next->val[r] + cs, (ce - cs) * sizeof(int));
+            cgBuildFlatMeshRegion(job->img, job->vertices, r, r + 1, cs, ce);
+            job->dirty[(size_t) r * job->tilesX + t] = 1;
+        }
+    }
+}
+
+int cgUpdateFlatMesh(
+    cgMat2i img,
+    cgMat2i next,
+    cgFlatVertex *vertices,
+    cgDirtyRange **ranges
+)
+{
+    cgUpdateJob job;
+    size_t pixelBytes = CG_MESH_FLAT_VERTICES * sizeof(cgFlatVertex);
+    size_t start, end;
+    int count = 0, capacity = 16;
+    int r, t;
+    cgArena scratch;
+    size_t mark;
+
+    if (img->height != next->height || img->width != next->width)
+    {
+        cgError("cgUpdateFlatMesh", "Image size changed.");
+        return -1;
+    }
+
+    if (img->layout != next->layout)
+    {
+        cgError("cgUpdateFlatMesh", "Image layout changed.");
+        return -1;
+    }
+
+    /* Every value is normalized by maxval. */
+    if (img->maxval != next->maxval)
+    {
+        cgError("cgUpdateFlatMesh", "Image maxval changed.");
+        return -1;
+    }
+
+    job.img      = img;
+    job.next     = next;
+    job.vertices = vertices;
+    job.tilesX   = (img->width + CG_MESH_DIRTY_TILE - 1) / CG_MESH_DIRTY_TILE;
+    scratch      = cgScratchArena();
+    mark         = (scratch != NULL) ? cgArenaMark(scratch) : 0;
+    job.dirty    = (scratch != NULL) ? (unsigned char*) cgArenaAlloc(scratch, (size_t) img->height * job.tilesX) : NULL;
+    *ranges      = (cgDirtyRange*) cgPoolAlloc(capacity * sizeof(cgDirtyRange));
+
+    if (job.dirty == NULL || *ranges == NULL)
+    {
+        cgError("cgUpdateFlatMesh", "No memory available.");
+        if (scratch != NULL)
+            cgArenaRewind(scratch, mark);
+        cgPoolFree(*ranges);
+        *ranges = NULL;
+        return -1;
+    }
+    memset(job.dirty, 0, (size_t) img->height * job.tilesX);
+
+    cgParallelFor2D(0, img->height, 0, 1, MeshGrainRows(img), 1, UpdateBlock, &job, NULL);
+
+    /* Turn dirty tiles into byte ranges, in buffer order. */
+    for (r = 0; r < img->height; r++)
+    {
+        for (t = 0; t < job.tilesX; t++)
+        {
+            if (!job.dirty[(size_t) r * job.tilesX + t])
+                continue;
+
+            start = ((size_t) r * img->width + t * CG_MESH_DIRTY_TILE) * pixelBytes;
+            end = (t == job.tilesX - 1) ? ((size_t) r + 1) * img->width * pixelBytes
+                                        : start + CG_MESH_DIRTY_TILE * pixelBytes;
+
+            if (count > 0 && start <= (*ranges)[count - 1].offset + (*ranges)[count - 1].size + CG_MESH_MERGE_GAP)
+            {
+                (*ranges)[count - 1].size = end - (*ranges)[count - 1].offset;
+                continue;
+            }
+
+            if (count == capacity)
+            {
+                capacity *= 2;
+                cgDirtyRange *grown = (cgDirtyRange*) cgPoolRealloc(*ranges, capacity * sizeof(cgDirtyRange));
+                if (grown == NULL)
+                {
+                    cgError("cgUpdateFlatMesh", "No memory available.");
+                    cgArenaRewind(scratch, mark);
+                    cgPoolFree(*ranges);
+                    *ranges = NULL;
+                    return -1;
+                }
+                *ranges = grown;
+            }
+
+            (*ranges)[count].offset = start;
+            (*ranges)[count].size = end - start;
+            count++;
+        }
+    }
+
+    cgArenaRewind(scratch, mark);
+
+    return count;
+}
+
+uint32_t cgPackNormal(
+    float x,
+    float y,
+    float z
+)
+{
+    uint32_t ix = (uint32_t) (int) floorf(x * 511.0f + 0.5f) & 0x3ff;
+    uint32_t iy = (uint32_t) (int) floorf(y * 511.0f + 0.5f) & 0x3ff;
+    uint32_t iz = (uint32_t) (int) floorf(z * 511.0f + 0.5f) & 0x3ff;
+
+    return ix | (iy << 10) | (iz << 20);
+}
+
+/* Reads row r, columns [c0 - 1, c1 + 1), into buf, replicating the
+ * borders of the image. */
+static void FetchPaddedRow(
+    cgMat2i img,
+    int r,
+    int c0,
+    int c1,
+    int *buf
+)
+{
+    int lo = (c0 > 0) ? c0 - 1 : 0;
+    int hi = (c1 < img->width) ? c1 + 1 : img->width;
+
+    r = (r < 0) ? 0 : ((r >= img->height) ? img->height - 1 : r);
+    cgMatGetRow2i(img, r, lo, hi, buf + (lo - (c0 - 1)));
+
+    if (c0 == 0)
+        buf[0] = buf[1];
+    if (c1 == img->width)
+        buf[c1 - c0 + 1] = buf[c1 - c0];
+}
+
+void cgBuildHeightMeshRegion(
+    cgMat2i img,
+    cgHeightVertex *vertices,
+    float scale,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    int n = c1 - c0;
+    int r, j;
+
+    /* A Sobel sum is 8 times the per-pixel derivative; the grid step is
+     * 2 / (size - 1) in normalized coordinates. Rows grow towards -Y. */
+    float kx = -scale / img->maxval / 8.0f * (img->width - 1) / 2.0f;
+    float ky = scale / img->maxval / 8.0f * (img->height - 1) / 2.0f;
+    float kz = 1.0f / img->maxval;
+
+    cgArena scratch = cgScratchArena();
+    if (scratch == NULL)
+    {
+        cgError("cgBuildHeightMeshRegion", "No memory available.");
+        return;
+    }
+
+    size_t mark = cgArenaMark(scratch);
+    int *buf = (int*) cgArenaAlloc(scratch, (size_t) 3 * (n + 2) * sizeof(int));
+    int *gx = (int*) cgArenaAlloc(scratch, (size_t) 2 * n * sizeof(int));
+    float *x = (float*) cgArenaAlloc(scratch, (size_t) n * sizeof(float));
+
+    if (buf == NULL || gx == NULL || x == NULL)
+    {
+        cgError("cgBuildHeightMeshRegion", "No memory available.");
+        cgArenaRewind(scratch, mark);
+        return;
+    }
+
+    int *gy = gx + n;
+    int *above = buf;
+    int *center = buf + (n + 2);
+    int *below = buf + 2 * (n + 2);
+
+    for (j = 0; j < n; j++)
+        x[j] = cgMapColumn2X(c0 + j, img->width);
+
+    /* Three rolling rows: each step reads a single new row. */
+    FetchPaddedRow(img, r0 - 1, c0, c1, above);
+    FetchPaddedRow(img, r0, c0, c1, center);
+
+    for (r = r0; r < r1; r++)
+    {
+        FetchPaddedRow(img, r + 1, c0, c1, below);
+
+        for (j = 0; j < n; j++)
+        {
+            gx[j] = (above[j + 2] - above[j]) + 2 * (center[j + 2] - center[j]) + (below[j + 2] - below[j]);
+            gy[j] = (below[j] + 2 * below[j + 1] + below[j + 2]) - (above[j] + 2 * above[j + 1] + above[j + 2]);
+        }
+
+        float y = cgMapRow2Y(r, img->height);
+        cgHeightVertex *v = vertices + (size_t) r * img->width + c0;
+
+        for (j = 0; j < n; j++)
+        {
+            float nx = kx * gx[j];
+            float ny = ky * gy[j];
+            float inv = 1.0f / sqrtf(nx * nx + ny * ny + 1.0f);
+
+            v[j].x = x[j];
+            v[j].y = y;
+            v[j].z = center[j + 1] * kz;
+            v[j].normal = cgPackNormal(nx * inv, ny * inv, inv);
+        }
+
+        int *t = above;
+        above = center;
+        center = below;
+        below = t;
+    }
+
+    cgArenaRewind(scratch, mark);
+}
+
+static void HeightMeshBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgHeightMeshJob *job = (cgHeightMeshJob*) arg;
+
+    cgBuildHeightMeshRegion(job->img, job->vertices, job->scale, r0, r1, c0, c1);
+}
+
+cgHeightVertex *cgBuildHeightMesh(
+    cgMat2i img,
+    cgHeightVertex *vertices,
+    float scale
+)
+{
+    cgHeightMeshJob job;
+
+    if (img == NULL || img->height < 2 || img->width < 2)
+    {
+        cgError("cgBuildHeightMesh", "Image must be at least 2x2.");
+        return NULL;
+    }
+
+    if (vertices == NULL)
+    {
+        vertices = (cgHeightVertex*) cgPoolAlloc((size_t) img->height * img->width * sizeof(cgHeightVertex));
+        if (vertices == NULL)
+        {
+            cgError("cgBuildHeightMesh", "No memory available.");
+            return NULL;
+        }
+    }
+
+    job.img = img;
+    job.vertices = vertices;
+    job.scale = scale;
+    cgParallelFor2D(0, img->height, 0, img->width, MeshGrainRows(img), img->width,
+                    HeightMeshBlock, &job, NULL);
+
+    return vertices;
+}
+
+static void HeightIndexBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    cgHeightIndexJob *job = (cgHeightIndexJob*) arg;
+    int w = job->width;
+    int r, c;
+
+    (void) c0;
+    (void) c1;
+
+    for (r = r0; r < r1; r++)
+    {
+        uint32_t *p = job->indices + (size_t) r * (w - 1) * 6;
+
+        for (c = 0; c < w - 1; c++)
+        {
+            uint32_t i0 = (uint32_t) r * w + c;
+            uint32_t i1 = i0 + w;
+
+            /* First triangle. */
+            p[0] = i0;
+            p[1] = i1;
+            p[2] = i0 + 1;
+
+            /* Second triangle. */
+            p[3] = i1;
+            p[4] = i1 + 1;
+            p[5] = i0 + 1;
+            p += 6;
+        }
+    }
+}
+
+uint32_t *cgBuildHeightIndices(
+    int height,
+    int width,
+    size_t *count
+)
+{
+    cgHeightIndexJob job;
+
+    if (height < 2 || width < 2)
+    {
+        cgError("cgBuildHeightIndices", "Grid must be at least 2x2.");
+        return NULL;
+    }
+
+    *count = (size_t) (height - 1) * (width - 1) * 6;
+    job.width = width;
+    job.indices = (uint32_t*) cgPoolAlloc(*count * sizeof(uint32_t));
+    if (job.indices == NULL)
+    {
+        cgError("cgBuildHeightIndices", "No memory available.");
+        return NULL;
+    }
+
+    cgParallelFor2D(0, height - 1, 0, 1, 64, 1, HeightIndexBlock, &job, NULL);
+
+    return job.indices;
+}
+
+/* Random value of a pixel, independent of the blocks and threads. */
+static uint32_t HashPixel(
+    uint32_t seed,
+    int r,
+    int c
+)
+{
+    uint32_t h = seed ^ ((uint32_t) r * 0x9e3779b1u) ^ ((uint32_t) c * 0x85ebca77u);
+
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static int KeepPoint(
+    const cgPointJob *job,
+    int r,
+    int c,
+    int value
+)
+{
+    const cgPointFilter *f = job->filter;
+
+    if (value < f->low || value > f->high)
+        return CG_FALSE;
+    if (f->stride > 1 && (r % f->stride != 0 || c % f->stride != 0))
+        return CG_FALSE;
+
+    return (job->limit == UINT32_MAX) || ((HashPixel(f->seed, r, c) >> 8) < job->limit);
+}
+
+/* Both passes read whole rows in storage order through the same test, so
+ * the counts match what is written. */
+static void PointBlock(
+    cgPointJob *job,
+    int b,
+    int write
+)
+{
+    cgMat2i img = job->img;
+    int r0 = b * POINT_BLOCK_ROWS;
+    int r1 = (r0 + POINT_BLOCK_ROWS < img->height) ? r0 + POINT_BLOCK_ROWS : img->height;
+    int *row = NULL;
+    const int *pix;
+    cgFlatVertex *v = NULL;
+    float scale = 65535.0f / img->maxval;
+    size_t n = 0, mark = 0;
+    int r, c;
+    cgArena scratch = NULL;
+
+    if (img->layout != CG_LAYOUT_ROW_MAJOR)
+    {
+        scratch = cgScratchArena();
+        if (scratch != NULL)
+        {
+            mark = cgArenaMark(scratch);
+            row = (int*) cgArenaAlloc(scratch, img->width * sizeof(int));
+        }
+        if (row == NULL)
+        {
+            if (!write)
+                job->first[b] = 0;
+            __atomic_store_n(&job->failed, CG_TRUE, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    if (write)
+        v = job->vertices + job->first[b];
+
+    for (r = r0; r < r1; r++)
+    {
+        if (row != NULL)
+        {
+            cgMatGetRow2i(img, r, 0, img->width, row);
+            pix = row;
+        }
+        else
+        {
+            pix = img->val[r];
+        }
+
+        for (c = 0; c < img->width; c++)
+        {
+            if (!KeepPoint(job, r, c, pix[c]))
+                continue;
+            if (write)
+            {
+                float x = 0.5f * (cgMapColumn2X(c, img->width + 1) + cgMapColumn2X(c + 1, img->width + 1));
+                float y = 0.5f * (cgMapRow2Y(r, img->height + 1) + cgMapRow2Y(r + 1, img->height + 1));
+                v = AddVertex(v, x, y, cgMeshValue(pix[c], scale));
+            }
+            n++;
+        }
+    }
+
+    if (!write)
+        job->first[b] = n;
+
+    if (scratch != NULL)
+        cgArenaRewind(scratch, mark);
+}
+
+static void CountPointsBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    int b;
+
+    (void) c0;
+    (void) c1;
+
+    for (b = r0; b < r1; b++)
+        PointBlock((cgPointJob*) arg, b, CG_FALSE);
+}
+
+static void WritePointsBlock(
+    void *arg,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+)
+{
+    int b;
+
+    (void) c0;
+    (void) c1;
+
+    for (b = r0; b < r1; b++)
+        PointBlock((cgPointJob*) arg, b, CG_TRUE);
+}
+
+cgFlatVertex *cgBuildPointCloud(
+    cgMat2i img,
+    const cgPointFilter *filter,
+    size_t *count
+)
+{
+    cgPointJob job;
+    size_t total = 0, n;
+    int blocks, b;
+
+    if (img == NULL)
+    {
+        cgError("cgBuildPointCloud", "NULL image.");
+        return NULL;
+    }
+
+    blocks = (img->height + POINT_BLOCK_ROWS - 1) / POINT_BLOCK_ROWS;
+    job.img = img;
+    job.filter = filter;
+    job.limit = (filter->fraction >= 1.0f) ? UINT32_MAX :
+                (filter->fraction <= 0.0f) ? 0 : (uint32_t) (filter->fraction * 16777216.0f);
+    job.failed = CG_FALSE;
+    job.first = (size_t*) cgPoolAlloc((blocks + 1) * sizeof(size_t));
+    if (job.first == NULL)
+    {
+        cgError("cgBuildPointCloud", "No memory available.");
+        return NULL;
+    }
+
+    /* Count, then turn the counts into block offsets. */
+    cgParallelFor2D(0, blocks, 0, 1, 1, 1, CountPointsBlock, &job, NULL);
+    for (b = 0; b < blocks; b++)
+    {
+        n = job.first[b];
+        job.first[b] = total;
+        total += n;
+    }
+    job.first[blocks] = total;
+
+    job.vertices = job.failed ? NULL : (cgFlatVertex*) cgPoolAlloc((total > 0 ? total : 1) * sizeof(cgFlatVertex));
+    if (job.vertices == NULL)
+    {
+        cgError("cgBuildPointCloud", "No memory available.");
+        cgPoolFree(job.first);
+        return NULL;
+    }
+
+    /* A block without its row buffer leaves its slots unwritten. */
+    cgParallelFor2D(0, blocks, 0, 1, 1, 1, WritePointsBlock, &job, NULL);
+    cgPoolFree(job.first);
+    if (job.failed)
+    {
+        cgError("cgBuildPointCloud", "No memory available.");
+        cgPoolFree(job.vertices);
+        return NULL;
+    }
+
+    *count = total;
+
+    return job.vertices;
+}
@@ -0,0 +1,290 @@
+/**
+ * @file cgMesh.h
+ * @brief Declaration of the mesh generation functions.
+ *
+ * The flat mesh has two triangles per pixel. Each vertex stores its
+ * position (x, y) as floats and the intensity once, normalized by the image
+ * maxval to an unsigned 16-bit value (a cgFlatVertex, 12 bytes); color comes
+ * from a lookup table at draw time. A pixel takes CG_MESH_FLAT_VERTICES
+ * vertices, placed at pixel index * CG_MESH_FLAT_VERTICES.
+ *
+ * The height mesh has one vertex per pixel, shared by the triangles around
+ * it and drawn through an index buffer. Its z is the intensity over maxval
+ * and its normal, packed as GL_INT_2_10_10_10_REV, comes from a Sobel pass
+ * over the image.
+ *
+ * The point cloud has one vertex per kept pixel, in the flat vertex format
+ * and in row-major order, with no gaps: pixels outside an intensity window
+ * or a subsample are compacted away.
+ */
+
+
+#ifndef _CGMESH_H_
+#define _CGMESH_H_
+
+
+/* Includes. */
+#include <stdint.h>
+#include "cgImage.h"
+
+
+/* Defines. */
+#define CG_MESH_FORMAT_FLAT   1
+#define CG_MESH_FORMAT_HEIGHT 2
+
+#define CG_MESH_FLAT_VERTICES 6
+
+#define CG_MESH_DIRTY_TILE 64
+#define CG_MESH_MERGE_GAP  65536
+
+
+/* Types. */
+
+/// cgDirtyRange
+/** A byte range of a vertex buffer that must be uploaded again.
+ */
+typedef struct cg_dirty_range
+{
+    /// Offset.
+    /** Offset of the range in bytes. */
+    size_t offset;
+    /// Size.
+    /** Size of the range in bytes. */
+    size_t size;
+
+} cgDirtyRange;
+
+/// cgFlatVertex
+/** A vertex of the flat mesh, point cloud and isolines (12 bytes).
+ */
+typedef struct cg_flat_vertex
+{
+    /// Position.
+    /** X and Y in [-1, 1]; z is 0. */
+    float x, y;
+    /// Value.
+    /** Intensity normalized to [0, 65535] (drawn as GL_UNSIGNED_SHORT,
+     * normalized). */
+    uint16_t value;
+    /// Padding.
+    /** Keeps vertices 4-byte aligned. */
+    uint16_t pad;
+
+} cgFlatVertex;
+
+/// cgHeightVertex
+/** A vertex of the height mesh (16 bytes).
+ */
+typedef struct cg_height_vertex
+{
+    /// Position.
+    /** X and Y in [-1, 1]; Z is the intensity over maxval, in [0, 1]. */
+    float x, y, z;
+    /// Normal.
+    /** Unit normal packed as signed normalized 10:10:10:2. */
+    uint32_t normal;
+
+} cgHeightVertex;
+
+/// cgPointFilter
+/** Pixels kept in a point cloud.
+ */
+typedef struct cg_point_filter
+{
+    /// Intensity window.
+    /** Pixels with low <= intensity <= high are kept. */
+    int low, high;
+    /// Stride.
+    /** Only pixels whose row and column are multiples of it are kept. */
+    int stride;
+    /// Fraction.
+    /** Probability of keeping a pixel, in [0, 1]. */
+    float fraction;
+    /// Seed.
+    /** Seed of the random subsample; the same seed keeps the same pixels. */
+    uint32_t seed;
+
+} cgPointFilter;
+
+
+/* Functions. */
+
+/// Normalize intensity.
+/**
+ * This function maps an intensity to the value of a cgFlatVertex.
+ * @param v intensity.
+ * @param scale 65535 / maxval.
+ * @return value, clamped to [0, 65535].
+ */
+static inline uint16_t cgMeshValue(
+    float v,
+    float scale
+)
+{
+    v = v * scale + 0.5f;
+
+    return (v <= 0.0f) ? 0 : ((v >= 65535.0f) ? 65535 : (uint16_t) v);
+}
+
+/// Map row to Y.
+/**
+ * This function maps a row to the normalized Y coordinate [-1, 1].
+ * @param r row.
+ * @param h number of rows.
+ * @return Y coordinate.
+ */
+float cgMapRow2Y(
+    int r,
+    int h
+);
+
+/// Map column to X.
+/**
+ * This function maps a column to the normalized X coordinate [-1, 1].
+ * @param c column.
+ * @param w number of columns.
+ * @return X coordinate.
+ */
+float cgMapColumn2X(
+    int c,
+    int w
+);
+
+/// Build flat mesh region.
+/**
+ * This function writes the vertices of the pixels [r0, r1) x [c0, c1) of
+ * an image.
+ * @param img image.
+ * @param vertices vertex buffer of the whole image.
+ * @param r0 first row.
+ * @param r1 last row (exclusive).
+ * @param c0 first column.
+ * @param c1 last column (exclusive).
+ */
+void cgBuildFlatMeshRegion(
+    cgMat2i img,
+    cgFlatVertex *vertices,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+);
+
+/// Build flat mesh.
+/**
+ * This function writes the vertices of a whole image in parallel.
+ * @param img image.
+ * @param vertices vertex buffer with CG_MESH_FLAT_VERTICES vertices per
+ * pixel, or NULL to allocate a new one from the pool (free with cgPoolFree).
+ * @return vertex buffer or NULL in error.
+ */
+cgFlatVertex *cgBuildFlatMesh(
+    cgMat2i img,
+    cgFlatVertex *vertices
+);
+
+/// Update flat mesh.
+/**
+ * This function compares a new image with the resident one, row by row and
+ * then in tiles of CG_MESH_DIRTY_TILE columns. Only the vertices of changed
+ * tiles are written again, and the new pixels are copied into the resident
+ * image. Ranges closer than CG_MESH_MERGE_GAP bytes are merged.
+ * @param img resident image (updated).
+ * @param next new image, with the same size and maxval as img.
+ * @param vertices vertex buffer of img (updated).
+ * @param ranges returned byte ranges of vertices to upload (free with cgPoolFree).
+ * @return number of ranges or -1 in error.
+ */
+int cgUpdateFlatMesh(
+    cgMat2i img,
+    cgMat2i next,
+    cgFlatVertex *vertices,
+    cgDirtyRange **ranges
+);
+
+/// Pack normal.
+/**
+ * This function packs a unit vector as GL_INT_2_10_10_10_REV (x in the low
+ * bits, w = 0).
+ * @param x X component.
+ * @param y Y component.
+ * @param z Z component.
+ * @return packed normal.
+ */
+uint32_t cgPackNormal(
+    float x,
+    float y,
+    float z
+);
+
+/// Build height mesh region.
+/**
+ * This function writes the vertices of the pixels [r0, r1) x [c0, c1) of
+ * an image. Normals are those of the surface scaled by scale along Z, so
+ * the shader must use the same scale.
+ * @param img image (at least 2x2).
+ * @param vertices vertex buffer of the whole image.
+ * @param scale height of the maximum intensity.
+ * @param r0 first row.
+ * @param r1 last row (exclusive).
+ * @param c0 first column.
+ * @param c1 last column (exclusive).
+ */
+void cgBuildHeightMeshRegion(
+    cgMat2i img,
+    cgHeightVertex *vertices,
+    float scale,
+    int r0,
+    int r1,
+    int c0,
+    int c1
+);
+
+/// Build height mesh.
+/**
+ * This function writes the vertices of a whole image in parallel.
+ * @param img image (at least 2x2).
+ * @param vertices vertex buffer with one vertex per pixel, or NULL to
+ * allocate a new one from the pool (free with cgPoolFree).
+ * @param scale height of the maximum intensity.
+ * @return vertex buffer or NULL in error.
+ */
+cgHeightVertex *cgBuildHeightMesh(
+    cgMat2i img,
+    cgHeightVertex *vertices,
+    float scale
+);
+
+/// Build height mesh indices.
+/**
+ * This function writes the triangle indices of a height x width grid, two
+ * triangles per cell, in the same winding as the flat mesh.
+ * @param height number of rows (at least 2).
+ * @param width number of columns (at least 2).
+ * @param count returned number of indices.
+ * @return index buffer (free with cgPoolFree) or NULL in error.
+ */
+uint32_t *cgBuildHeightIndices(
+    int height,
+    int width,
+    size_t *count
+);
+
+/// Build point cloud.
+/**
+ * This function writes one vertex (a cgFlatVertex at the pixel center) for
+ * every pixel kept by the filter. Blocks of rows count their pixels in
+ * parallel, a prefix sum of the counts gives each block its place in the
+ * output and the blocks then write in parallel.
+ * @param img image.
+ * @param filter pixels to keep.
+ * @param count returned number of vertices.
+ * @return vertex buffer (free with cgPoolFree) or NULL in error.
+ */
+cgFlatVertex *cgBuildPointCloud(
+    cgMat2i img,
+    const cgPointFilter *filter,
+    size_t *count
+);
+
+#endif /* _CGMESH_H_ */
@@ -0,0 +1,412 @@
+/**
+ * @file cgMeshCache.c
+ * @brief Implementation of the persistent mesh cache functions.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cgMeshCache.h"
+
+
+/* On-disk header. Sections follow the source path, each one aligned to
+ * CG_MESH_CACHE_ALIGN bytes: pixels, vertices and indices. */
+typedef struct cg_mesh_cache_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pathLength;
+    int32_t  format;
+    uint64_t size;
+    int64_t  mtime;
+    uint64_t hash;
+    uint64_t options;
+    int32_t  height;
+    int32_t  width;
+    int32_t  maxval;
+    int32_t  reserved;
+    uint64_t pixelOffset;
+    uint64_t vertexOffset;
+    uint64_t vertexBytes;
+    uint64_t indexOffset;
+    uint64_t indexCount;
+    uint64_t fileSize;
+
+} cgMeshCacheHeader;
+
+
+static uint64_t AlignOffset(
+    uint64_t offset
+)
+{
+    return (offset + CG_MESH_CACHE_ALIGN - 1) & ~(uint64_t)(CG_MESH_CACHE_ALIGN - 1);
+}
+
+/* Whether a section starts aligned inside the file and fits before its
+ * end; offsets are checked before sizes so nothing can wrap. */
+static int ValidSection(
+    uint64_t offset,
+    uint64_t bytes,
+    uint64_t fileSize
+)
+{
+    return offset % CG_MESH_CACHE_ALIGN == 0 &&
+           offset <= fileSize && bytes <= fileSize - offset;
+}
+
+static int WritePadding(
+    FILE *fp,
+    uint64_t from,
+    uint64_t to
+)
+{
+    static const char zeros[CG_MESH_CACHE_ALIGN] = {0};
+
+    if (to == from)
+        return CG_TRUE;
+
+    return fwrite(zeros, 1, to - from, fp) == to - from;
+}
+
+uint64_t cgHash64(
+    const void *data,
+    size_t length,
+    uint64_t seed
+)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    uint64_t h = (seed != 0) ? seed : 14695981039346656037ull;
+    uint64_t w;
+
+    /* Eight bytes per step; the shift folds high bits back down since the
+     * multiplication only propagates towards them. */
+    while (length >= 8)
+    {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 1099511628211ull;
+        h ^= h >> 32;
+        p += 8;
+        length -= 8;
+    }
+
+    while (length > 0)
+    {
+        h = (h ^ *p) * 1099511628211ull;
+        p++;
+        length--;
+    }
+
+    return h;
+}
+
+int cgMeshKeyFromFile(
+    const char *fname,
+    int format,
+    const char *options,
+    cgMeshKey *key
+)
+{
+    struct stat st;
+    void *map;
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return CG_FALSE;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return CG_FALSE;
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->size    = (uint64_t) st.st_size;
+    key->mtime   = (int64_t) st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    key->format  = format;
+    key->options = (options != NULL) ? cgHash64(options, strlen(options), 0) : 0;
+
+    /* Hash the content. */
+    if (st.st_size > 0)
+    {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            return CG_FALSE;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        key->hash = cgHash64(map, st.st_size, 0);
+        munmap(map, st.st_size);
+    }
+
+    close(fd);
+
+    return CG_TRUE;
+}
+
+int cgCacheDirectory(
+    char *dir,
+    size_t size
+)
+{
+    const char *env;
+
+    if ((env = getenv("CG_MESH_CACHE_DIR")) != NULL)
+    {
+        if (*env == '\0')
+            return CG_FALSE;
+        snprintf(dir, size, "%s", env);
+    }
+    else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env != '\0')
+    {
+        snprintf(dir, size, "%s/opengl-cpp", env);
+    }
+    else if ((env = getenv("HOME")) != NULL && *env != '\0')
+    {
+        snprintf(dir, size, "%s/.cache", env);
+        mkdir(dir, 0755);
+        snprintf(dir, size, "%s/.cache/opengl-cpp", env);
+    }
+    else
+    {
+        return CG_FALSE;
+    }
+
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+char *cgMeshCachePath(
+    const char *fname
+)
+{
+    char dir[PATH_MAX];
+    char *full, *cname;
+
+    if (!cgCacheDirectory(dir, sizeof(dir)))
+        return NULL;
+
+    /* The file name is derived from the absolute source path. */
+    full = realpath(fname, NULL);
+    if (full == NULL)
+        return NULL;
+
+    cname = (char*) malloc(strlen(dir) + 32);
+    if (cname != NULL)
+        sprintf(cname, "%s/%016llx.cgmesh",
+                dir, (unsigned long long) cgHash64(full, strlen(full), 0));
+
+    free(full);
+
+    return cname;
+}
+
+cgMeshCache cgOpenMeshCache(
+    const char *cname,
+    const char *fname,
+    const cgMeshKey *key
+)
+{
+    struct stat st;
+    cgMeshCacheHeader *hdr;
+    cgMeshCache cache;
+    char *full;
+    void *map;
+    uint64_t size, pixels;
+
+    int fd = open(cname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(cgMeshCacheHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    /* Private writable mapping: callers may patch the buffers in place
+     * without touching the file. */
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    hdr = (cgMeshCacheHeader*) map;
+    size = (uint64_t) st.st_size;
+    pixels = (hdr->height > 0 && hdr->width > 0) ? (uint64_t) hdr->height * hdr->width : 0;
+
+    /* Validate layout. Counts are bounded by the file size before they are
+     * turned into bytes. */
+    if (hdr->magic != CG_MESH_CACHE_MAGIC ||
+        hdr->version != CG_MESH_CACHE_VERSION ||
+        hdr->fileSize != size ||
+        pixels == 0 || hdr->maxval < 1 ||
+        pixels > size / sizeof(int32_t) ||
+        hdr->indexCount > size / sizeof(uint32_t) ||
+        !ValidSection(hdr->pixelOffset, pixels * sizeof(int32_t), size) ||
+        !ValidSection(hdr->vertexOffset, hdr->vertexBytes, size) ||
+        !ValidSection(hdr->indexOffset, hdr->indexCount * sizeof(uint32_t), size) ||
+        sizeof(cgMeshCacheHeader) + hdr->pathLength > hdr->pixelOffset ||
+        hdr->pixelOffset + pixels * sizeof(int32_t) > hdr->vertexOffset ||
+        hdr->vertexOffset + hdr->vertexBytes > hdr->indexOffset)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    /* Validate key. */
+    if (hdr->size != key->size || hdr->mtime != key->mtime ||
+        hdr->hash != key->hash || hdr->options != key->options ||
+        hdr->format != key->format)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    /* Validate source path (guards against hash collisions of names). */
+    full = realpath(fname, NULL);
+    if (full == NULL || strlen(full) != hdr->pathLength ||
+        memcmp(full, (char*) map + sizeof(cgMeshCacheHeader), hdr->pathLength) != 0)
+    {
+        free(full);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    free(full);
+
+    cache = (cgMeshCache) malloc(sizeof(struct cg_mesh_cache));
+    if (cache == NULL)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    cache->map         = map;
+    cache->length      = st.st_size;
+    cache->height      = hdr->height;
+    cache->width       = hdr->width;
+    cache->maxval      = hdr->maxval;
+    cache->pixels      = (const int32_t*) ((char*) map + hdr->pixelOffset);
+    cache->vertices    = (char*) map + hdr->vertexOffset;
+    cache->vertexBytes = hdr->vertexBytes;
+    cache->indices     = hdr->indexCount ? (uint32_t*) ((char*) map + hdr->indexOffset) : NULL;
+    cache->indexCount  = hdr->indexCount;
+
+    return cache;
+}
+
+void cgCloseMeshCache(
+    cgMeshCache cache
+)
+{
+    if (cache == NULL)
+        return;
+
+    munmap(cache->map, cache->length);
+    free(cache);
+}
+
+int cgWriteMeshCache(
+    const char *cname,
+    const char *fname,
+    const cgMeshKey *key,
+    cgMat2i img,
+    const void *vertices,
+    size_t vertexBytes,
+    const uint32_t *indices,
+    size_t indexCount
+)
+{
+    cgMeshCacheHeader hdr;
+    char *full, *tmp;
+    int r, c, ok;
+
+    full = realpath(fname, NULL);
+    if (full == NULL)
+        return CG_FALSE;
+
+    /* Lay out the sections. */
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic        = CG_MESH_CACHE_MAGIC;
+    hdr.version      = CG_MESH_CACHE_VERSION;
+    hdr.pathLength   = strlen(full);
+    hdr.format       = key->format;
+    hdr.size         = key->size;
+    hdr.mtime        = key->mtime;
+    hdr.hash         = key->hash;
+    hdr.options      = key->options;
+    hdr.height       = img->height;
+    hdr.width        = img->width;
+    hdr.maxval       = img->maxval;
+    hdr.pixelOffset  = AlignOffset(sizeof(hdr) + hdr.pathLength);
+    hdr.vertexOffset = AlignOffset(hdr.pixelOffset + (uint64_t) img->height * img->width * sizeof(int32_t));
+    hdr.vertexBytes  = vertexBytes;
+    hdr.indexOffset  = AlignOffset(hdr.vertexOffset + vertexBytes);
+    hdr.indexCount   = indexCount;
+    hdr.fileSize     = hdr.indexOffset + indexCount * sizeof(uint32_t);
+
+    /* Write to a temporary file first. */
+    tmp = (char*) malloc(strlen(cname) + 32);
+    if (tmp == NULL)
+    {
+        free(full);
+        return CG_FALSE;
+    }
+    sprintf(tmp, "%s.%d.tmp", cname, (int) getpid());
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        free(tmp);
+        free(full);
+        return CG_FALSE;
+    }
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+         fwrite(full, 1, hdr.pathLength, fp) == hdr.pathLength &&
+         WritePadding(fp, sizeof(hdr) + hdr.pathLength, hdr.pixelOffset);
+
+    /* Pixels are stored row-major whatever the layout of img. */
+    if (img->layout == CG_LAYOUT_ROW_MAJOR)
+    {
+        ok = ok && fwrite(img->data, sizeof(int32_t), (size_t) img->height * img->width, fp) ==
+                   (size_t) img->height * img->width;
+    }
+    else
+    {
+        int32_t *row = (int32_t*) malloc(img->width * sizeof(int32_t));
+        ok = ok && (row != NULL);
+        for (r = 0; ok && r < img->height; r++)
+        {
+            for (c = 0; c < img->width; c++)
+                row[c] = cgMatAt2i(img, r, c);
+            ok = fwrite(row, sizeof(int32_t), img->width, fp) == (size_t) img->width;
+        }
+        free(row);
+    }
+
+    ok = ok &&
+         WritePadding(fp, hdr.pixelOffset + (uint64_t) img->height * img->width * sizeof(int32_t), hdr.vertexOffset) &&
+         fwrite(vertices, 1, vertexBytes, fp) == vertexBytes &&
+         WritePadding(fp, hdr.vertexOffset + vertexBytes, hdr.indexOffset) &&
+         (indexCount == 0 || fwrite(indices, sizeof(uint32_t), indexCount, fp) == indexCount);
+
+    if (fclose(fp) != 0)
+        ok = CG_FALSE;
+
+    if (ok)
+        ok = rename(tmp, cname) == 0;
+
+    if (!ok)
+    {
+        cgError("cgWriteMeshCache", "Unable to write cache file.");
+        unlink(tmp);
+    }
+
+    free(tmp);
+    free(full);
+
+    return ok ? CG_TRUE : CG_FALSE;
+}
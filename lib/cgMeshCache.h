@@ -0,0 +1,195 @@
+/**
+ * @file cgMeshCache.h
+ * @brief Declaration of the persistent mesh cache functions.
+ *
+ * A cache file stores the decoded image and the vertex/index buffers
+ * generated from it, so a later run on an unchanged source can map the
+ * file and hand the buffers straight to OpenGL.
+ */
+
+
+#ifndef _CGMESHCACHE_H_
+#define _CGMESHCACHE_H_
+
+
+/* Includes. */
+#include <stdint.h>
+#include "cgImage.h"
+
+
+/* Defines. */
+#define CG_MESH_CACHE_MAGIC   0x48534d43u /* "CMSH" */
+#define CG_MESH_CACHE_VERSION 2
+#define CG_MESH_CACHE_ALIGN   64
+
+
+/* Types. */
+
+/// cgMeshKey
+/** Identifies the source and the meshing parameters of a cached mesh.
+ */
+typedef struct cg_mesh_key
+{
+    /// Source size.
+    /** Size of the source file in bytes. */
+    uint64_t size;
+    /// Source modification time.
+    /** Modification time of the source file in nanoseconds. */
+    int64_t mtime;
+    /// Source hash.
+    /** Hash of the whole content of the source file. */
+    uint64_t hash;
+    /// Options hash.
+    /** Hash of the options used to build the mesh. */
+    uint64_t options;
+    /// Mesh format.
+    /** Identifier of the vertex layout stored in the cache. */
+    int32_t format;
+
+} cgMeshKey;
+
+/// cgMeshCache
+/** A memory mapped cache file. All pointers point into the mapping.
+ */
+typedef struct cg_mesh_cache
+{
+    /// Mapping.
+    /** Start of the mapped file. */
+    void *map;
+    /// Mapping length.
+    /** Length of the mapped file in bytes. */
+    size_t length;
+    /// Number of rows.
+    /** Number of rows of the cached image. */
+    int height;
+    /// Number of columns.
+    /** Number of columns of the cached image. */
+    int width;
+    /// Maximum intensity.
+    /** maxval of the cached image. */
+    int maxval;
+    /// Pixels.
+    /** Image pixels in row-major order. */
+    const int32_t *pixels;
+    /// Vertices.
+    /** Vertex buffer (mapped copy-on-write, so it may be modified). */
+    void *vertices;
+    /// Vertex buffer size.
+    /** Size of the vertex buffer in bytes. */
+    size_t vertexBytes;
+    /// Indices.
+    /** Index buffer or NULL when the mesh is not indexed. */
+    uint32_t *indices;
+    /// Number of indices.
+    /** Number of indices in the index buffer. */
+    size_t indexCount;
+
+} *cgMeshCache;
+
+
+/* Functions. */
+
+/// Build cache key.
+/**
+ * This function fills a cache key from the current state of a source file.
+ * @param fname source file name.
+ * @param format mesh format identifier.
+ * @param options string describing the meshing options (may be NULL).
+ * @param key returned key.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgMeshKeyFromFile(
+    const char *fname,
+    int format,
+    const char *options,
+    cgMeshKey *key
+);
+
+/// Cache directory.
+/**
+ * This function finds and creates the cache directory, taken from
+ * CG_MESH_CACHE_DIR, XDG_CACHE_HOME or HOME, in this order. An empty
+ * CG_MESH_CACHE_DIR disables caching.
+ * @param dir returned directory name.
+ * @param size size of dir.
+ * @return CG_TRUE if there is a cache directory; CG_FALSE otherwise.
+ */
+int cgCacheDirectory(
+    char *dir,
+    size_t size
+);
+
+/// Cache file name.
+/**
+ * This function returns the name of the cache file of a source file, in
+ * the directory given by cgCacheDirectory.
+ * @param fname source file name.
+ * @return newly allocated file name or NULL if there is no cache directory.
+ */
+char *cgMeshCachePath(
+    const char *fname
+);
+
+/// Open mesh cache.
+/**
+ * This function maps a cache file and validates it against a key.
+ * @param cname cache file name.
+ * @param fname source file name.
+ * @param key expected key.
+ * @return mapped cache or NULL if missing, stale or invalid.
+ */
+cgMeshCache cgOpenMeshCache(
+    const char *cname,
+    const char *fname,
+    const cgMeshKey *key
+);
+
+/// Close mesh cache.
+/**
+ * This function unmaps a cache file. Buffers taken from it become invalid.
+ * @param cache cache to be closed.
+ */
+void cgCloseMeshCache(
+    cgMeshCache cache
+);
+
+/// Write mesh cache.
+/**
+ * This function writes a cache file. The file is written to a temporary
+ * name and renamed, so readers never see a partial cache.
+ * @param cname cache file name.
+ * @param fname source file name.
+ * @param key key of the source.
+ * @param img source image.
+ * @param vertices vertex buffer.
+ * @param vertexBytes size of the vertex buffer in bytes.
+ * @param indices index buffer or NULL.
+ * @param indexCount number of indices.
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgWriteMeshCache(
+    const char *cname,
+    const char *fname,
+    const cgMeshKey *key,
+    cgMat2i img,
+    const void *vertices,
+    size_t vertexBytes,
+    const uint32_t *indices,
+    size_t indexCount
+);
+
+/// Hash buffer.
+/**
+ * This function computes a 64-bit FNV-1a style hash of a buffer.
+ * @param data buffer.
+ * @param length buffer length in bytes.
+ * @param seed initial value (use 0 for a fresh hash).
+ * @return hash value.
+ */
+uint64_t cgHash64(
+    const void *data,
+    size_t length,
+    uint64_t seed
+);
+
+#endif /* _CGMESHCACHE_H_ */
@@ -0,0 +1,492 @@
+/**
+ * @file cgPool.c
+ * @brief Implementation of the memory pool and scratch arenas.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "cgPool.h"
+
+
+/* Four classes per power of two above CG_POOL_ALIGN, up to 2^63. */
+#define POOL_CLASSES 233
+
+/* Default limit of the free lists, in megabytes. */
+#define POOL_CACHE_MB 1024
+
+/* Minimum chunk of the scratch arenas. */
+#define SCRATCH_CHUNK (((size_t) 1 << 20) - CG_POOL_ALIGN)
+
+
+/* Header in the first CG_POOL_ALIGN bytes of every block. */
+typedef struct cg_pool_block
+{
+    struct cg_pool_block *next;  /* Next block in the free list. */
+    void   *base;                /* System allocation. */
+    size_t  size;                /* Usable bytes (the class size). */
+    size_t  mapped;              /* Length of the mapping, 0 if malloced. */
+    int     cls;                 /* Size class. */
+
+} cgPoolBlock;
+
+/* Arena chunk, at the start of a pool block. Positions grow across the
+ * chunks, so a mark is a single number. */
+typedef struct cg_arena_chunk
+{
+    struct cg_arena_chunk *next;
+    size_t start;                /* Position of the first byte. */
+    size_t size;
+    size_t used;
+
+} cgArenaChunk;
+
+struct cg_arena
+{
+    cgArenaChunk *first;
+    cgArenaChunk *current;
+    size_t chunk;
+};
+
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static cgPoolBlock *freeLists[POOL_CLASSES];
+static cgPoolStats poolStats;
+static size_t cacheLimit = 0;
+
+static __thread cgArena scratch = NULL;
+
+
+/* Class of a request and its rounded size; -1 if too large. */
+static int SizeClass(
+    size_t size,
+    size_t *classSize
+)
+{
+    size_t e, step, k;
+
+    if (size <= CG_POOL_ALIGN)
+    {
+        *classSize = CG_POOL_ALIGN;
+        return 0;
+    }
+    if (size > ((size_t) 1 << 48))
+        return -1;
+
+    /* 2^e < size <= 2^(e + 1), in steps of 2^(e - 2). */
+    e = 63 - __builtin_clzll((unsigned long long) (size - 1));
+    step = (size_t) 1 << (e - 2);
+    k = (size - ((size_t) 1 << e) + step - 1) / step;
+
+    *classSize = ((size_t) 1 << e) + k * step;
+    return (int) ((e - 6) * 4 + k);
+}
+
+/* Maps length bytes aligned to CG_POOL_HUGE, so that the kernel can back
+ * them with huge pages. */
+static void *MapHuge(
+    size_t length
+)
+{
+    size_t extra = length + CG_POOL_HUGE;
+    uintptr_t start, aligned;
+    char *p;
+
+    p = (char*) mmap(NULL, extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    start = (uintptr_t) p;
+    aligned = (start + CG_POOL_HUGE - 1) & ~(uintptr_t) (CG_POOL_HUGE - 1);
+    if (aligned > start)
+        munmap(p, aligned - start);
+    if (aligned + length < start + extra)
+        munmap((char*) aligned + length, start + extra - aligned - length);
+
+#ifdef MADV_HUGEPAGE
+    madvise((void*) aligned, length, MADV_HUGEPAGE);
+#endif
+
+    return (void*) aligned;
+}
+
+/* Gives a block back to the system. Called without the lock. */
+static void ReleaseBlock(
+    cgPoolBlock *block
+)
+{
+    if (block->mapped > 0)
+        munmap(block->base, block->mapped);
+    else
+        free(block->base);
+}
+
+/* Takes a block of a class from its free list or from the system. Fresh
+ * mappings are already zeroed. */
+static cgPoolBlock *TakeBlock(
+    size_t size,
+    int *zeroed
+)
+{
+    cgPoolBlock *block;
+    size_t classSize, length;
+    void *base;
+    int cls = SizeClass(size, &classSize);
+
+    if (cls < 0)
+        return NULL;
+
+    pthread_mutex_lock(&poolLock);
+    block = freeLists[cls];
+    if (block != NULL)
+    {
+        freeLists[cls] = block->next;
+        poolStats.reused++;
+        poolStats.cachedBytes -= block->size;
+        poolStats.usedBytes += block->size;
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    if (block != NULL)
+    {
+        *zeroed = 0;
+        return block;
+    }
+
+    length = CG_POOL_ALIGN + classSize;
+    if (length >= CG_POOL_HUGE)
+    {
+        length = (length + CG_POOL_HUGE - 1) & ~(CG_POOL_HUGE - 1);
+        base = MapHuge(length);
+        *zeroed = 1;
+    }
+    else
+    {
+        if (posix_memalign(&base, CG_POOL_ALIGN, length) != 0)
+            base = NULL;
+        length = 0;
+        *zeroed = 0;
+    }
+    if (base == NULL)
+        return NULL;
+
+    block = (cgPoolBlock*) base;
+    block->base = base;
+    block->size = classSize;
+    block->mapped = length;
+    block->cls = cls;
+
+    pthread_mutex_lock(&poolLock);
+    poolStats.systemAllocs++;
+    poolStats.usedBytes += classSize;
+    poolStats.hugeBytes += length;
+    pthread_mutex_unlock(&poolLock);
+
+    return block;
+}
+
+static void *BlockData(
+    cgPoolBlock *block
+)
+{
+    return (char*) block + CG_POOL_ALIGN;
+}
+
+static cgPoolBlock *DataBlock(
+    void *ptr
+)
+{
+    return (cgPoolBlock*) ((char*) ptr - CG_POOL_ALIGN);
+}
+
+void *cgPoolAlloc(
+    size_t size
+)
+{
+    int zeroed;
+    cgPoolBlock *block = TakeBlock(size, &zeroed);
+
+    return (block != NULL) ? BlockData(block) : NULL;
+}
+
+void *cgPoolCalloc(
+    size_t count,
+    size_t size
+)
+{
+    int zeroed;
+    cgPoolBlock *block;
+
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+
+    block = TakeBlock(count * size, &zeroed);
+    if (block == NULL)
+        return NULL;
+
+    if (!zeroed)
+        memset(BlockData(block), 0, count * size);
+
+    return BlockData(block);
+}
+
+void *cgPoolRealloc(
+    void *ptr,
+    size_t size
+)
+{
+    cgPoolBlock *block;
+    void *grown;
+
+    if (ptr == NULL)
+        return cgPoolAlloc(size);
+
+    block = DataBlock(ptr);
+    if (size <= block->size)
+        return ptr;
+
+    grown = cgPoolAlloc(size);
+    if (grown == NULL)
+        return NULL;
+
+    memcpy(grown, ptr, block->size);
+    cgPoolFree(ptr);
+
+    return grown;
+}
+
+void cgPoolFree(
+    void *ptr
+)
+{
+    cgPoolBlock *block;
+    int keep;
+
+    if (ptr == NULL)
+        return;
+
+    block = DataBlock(ptr);
+
+    pthread_mutex_lock(&poolLock);
+    if (cacheLimit == 0)
+    {
+        const char *env = getenv("CG_POOL_CACHE");
+        long mb = (env != NULL) ? atol(env) : POOL_CACHE_MB;
+        cacheLimit = (mb > 0) ? (size_t) mb << 20 : 1;
+    }
+
+    poolStats.usedBytes -= block->size;
+    keep = poolStats.cachedBytes + block->size <= cacheLimit;
+    if (keep)
+    {
+        block->next = freeLists[block->cls];
+        freeLists[block->cls] = block;
+        poolStats.cachedBytes += block->size;
+    }
+    else
+        poolStats.hugeBytes -= block->mapped;
+    pthread_mutex_unlock(&poolLock);
+
+    if (!keep)
+        ReleaseBlock(block);
+}
+
+void cgPoolTrim(
+    void
+)
+{
+    cgPoolBlock *list = NULL, *block;
+    int c;
+
+    /* Detach all lists, then release outside the lock. */
+    pthread_mutex_lock(&poolLock);
+    for (c = 0; c < POOL_CLASSES; c++)
+    {
+        while ((block = freeLists[c]) != NULL)
+        {
+            freeLists[c] = block->next;
+            block->next = list;
+            list = block;
+            poolStats.hugeBytes -= block->mapped;
+        }
+    }
+    poolStats.cachedBytes = 0;
+    pthread_mutex_unlock(&poolLock);
+
+    while ((block = list) != NULL)
+    {
+        list = block->next;
+        ReleaseBlock(block);
+    }
+}
+
+void cgPoolGetStats(
+    cgPoolStats *stats
+)
+{
+    pthread_mutex_lock(&poolLock);
+    *stats = poolStats;
+    pthread_mutex_unlock(&poolLock);
+}
+
+cgArena cgCreateArena(
+    size_t chunk
+)
+{
+    cgArena arena = (cgArena) cgPoolAlloc(sizeof(struct cg_arena));
+
+    if (arena == NULL)
+        return NULL;
+
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->chunk = (chunk > 0) ? chunk : SCRATCH_CHUNK;
+
+    return arena;
+}
+
+cgArena cgScratchArena(
+    void
+)
+{
+    if (scratch == NULL)
+        scratch = cgCreateArena(SCRATCH_CHUNK);
+
+    return scratch;
+}
+
+void *cgArenaAlloc(
+    cgArena arena,
+    size_t size
+)
+{
+    cgArenaChunk *c = arena->current, *next;
+    size_t bytes;
+    void *p;
+
+    size = (size + CG_POOL_ALIGN - 1) & ~(size_t) (CG_POOL_ALIGN - 1);
+    if (size == 0)
+        size = CG_POOL_ALIGN;
+
+    /* Later chunks are empty after a rewind; one too small is skipped. */
+    while (c != NULL && c->used + size > c->size && c->next != NULL)
+    {
+        c = c->next;
+        c->used = 0;
+    }
+
+    if (c == NULL || c->used + size > c->size)
+    {
+        bytes = (size > arena->chunk) ? size : arena->chunk;
+        next = (cgArenaChunk*) cgPoolAlloc(CG_POOL_ALIGN + bytes);
+        if (next == NULL)
+            return NULL;
+
+        next->next = NULL;
+        next->start = (c != NULL) ? c->start + c->size : 0;
+        next->size = bytes;
+        next->used = 0;
+        if (c != NULL)
+            c->next = next;
+        else
+            arena->first = next;
+        c = next;
+    }
+
+    p = (char*) c + CG_POOL_ALIGN + c->used;
+    c->used += size;
+    arena->current = c;
+
+    return p;
+}
+
+size_t cgArenaMark(
+    cgArena arena
+)
+{
+    cgArenaChunk *c = arena->current;
+
+    return (c != NULL) ? c->start + c->used : 0;
+}
+
+void cgArenaRewind(
+    cgArena arena,
+    size_t mark
+)
+{
+    cgArenaChunk *c;
+
+    if (mark == 0)
+    {
+        cgResetArena(arena);
+        return;
+    }
+
+    for (c = arena->first; c != NULL; c = c->next)
+    {
+        if (mark <= c->start + c->size)
+        {
+            c->used = mark - c->start;
+            arena->current = c;
+            break;
+        }
+    }
+}
+
+void cgResetArena(
+    cgArena arena
+)
+{
+    cgArenaChunk *c = arena->first, *next;
+    size_t total = 0;
+
+    if (c == NULL)
+        return;
+
+    if (c->next == NULL)
+    {
+        c->used = 0;
+        arena->current = c;
+        return;
+    }
+
+    /* Several chunks were needed: replace them by one that holds all. */
+    for (; c != NULL; c = next)
+    {
+        next = c->next;
+        total += c->size;
+        cgPoolFree(c);
+    }
+
+    arena->first = (cgArenaChunk*) cgPoolAlloc(CG_POOL_ALIGN + total);
+    arena->current = arena->first;
+    if (arena->first != NULL)
+    {
+        arena->first->next = NULL;
+        arena->first->start = 0;
+        arena->first->size = total;
+        arena->first->used = 0;
+    }
+}
+
+void cgFreeArena(
+    cgArena arena
+)
+{
+    cgArenaChunk *c, *next;
+
+    if (arena == NULL)
+        return;
+
+    for (c = arena->first; c != NULL; c = next)
+    {
+        next = c->next;
+        cgPoolFree(c);
+    }
+    if (arena == scratch)
+        scratch = NULL;
+    cgPoolFree(arena);
+}
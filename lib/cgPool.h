@@ -0,0 +1,208 @@
+/**
+ * @file cgPool.h
+ * @brief Declaration of the memory pool and scratch arenas.
+ *
+ * Images, meshes and the other buffers handed to the caller come from a
+ * shared pool. Block sizes are rounded up to size classes (four per power of
+ * two, so at most a quarter is wasted) and freed blocks wait in a list per
+ * class for the next request of that class. Blocks of CG_POOL_HUGE bytes or
+ * more are mapped directly, aligned to CG_POOL_HUGE and advised to use huge
+ * pages. Reloading an image of the same size, or converting a batch of
+ * similar images, therefore reuses the same blocks without asking the
+ * system for memory.
+ *
+ * Temporary buffers live in scratch arenas: a bump pointer over chunks
+ * taken from the pool. A function marks the arena of its thread, allocates
+ * and rewinds to the mark before returning, so arenas nest like a stack
+ * (also when a waiting thread runs other tasks). Rewinding to the start, or
+ * an explicit reset between images, joins the chunks into one large enough
+ * for everything that was used, so the next image fits in a single chunk.
+ *
+ * The environment variable CG_POOL_CACHE limits the megabytes kept in the
+ * free lists (1024 by default); freed blocks beyond it go back to the
+ * system.
+ */
+
+
+#ifndef _CGPOOL_H_
+#define _CGPOOL_H_
+
+
+/* Includes. */
+#include <stddef.h>
+
+
+/* Defines. */
+#define CG_POOL_HUGE  ((size_t) 2 << 20) /* Mapped, huge-page blocks. */
+#define CG_POOL_ALIGN 64                 /* Alignment of every block. */
+
+
+/* Types. */
+
+/// cgPoolStats
+/** Pool counters since the start of the program.
+ */
+typedef struct cg_pool_stats
+{
+    /// System allocations.
+    /** Blocks requested from the system (malloc or mmap). */
+    size_t systemAllocs;
+    /// Reused blocks.
+    /** Requests served from the free lists. */
+    size_t reused;
+    /// Bytes in use.
+    /** Bytes of the blocks held by the program. */
+    size_t usedBytes;
+    /// Cached bytes.
+    /** Bytes of the blocks waiting in the free lists. */
+    size_t cachedBytes;
+    /// Huge bytes.
+    /** Bytes of the mapped blocks, used or cached. */
+    size_t hugeBytes;
+
+} cgPoolStats;
+
+/// cgArena
+/** A scratch arena.
+ */
+typedef struct cg_arena *cgArena;
+
+
+/* Functions. */
+
+/// Pool allocation.
+/**
+ * This function allocates a block from the pool, aligned to CG_POOL_ALIGN
+ * bytes. The contents are undefined.
+ * @param size size in bytes.
+ * @return block (free with cgPoolFree) or NULL in error.
+ */
+void *cgPoolAlloc(
+    size_t size
+);
+
+/// Pool zeroed allocation.
+/**
+ * This function allocates a block of count * size zeroed bytes.
+ * @param count number of elements.
+ * @param size size of an element.
+ * @return block (free with cgPoolFree) or NULL in error.
+ */
+void *cgPoolCalloc(
+    size_t count,
+    size_t size
+);
+
+/// Pool reallocation.
+/**
+ * This function grows or shrinks a block, keeping its contents. A block
+ * whose size class still fits is returned as is.
+ * @param ptr block (or NULL).
+ * @param size new size in bytes.
+ * @return block or NULL in error (ptr is kept).
+ */
+void *cgPoolRealloc(
+    void *ptr,
+    size_t size
+);
+
+/// Pool free.
+/**
+ * This function returns a block to the free list of its class.
+ * @param ptr block (or NULL).
+ */
+void cgPoolFree(
+    void *ptr
+);
+
+/// Pool trim.
+/**
+ * This function gives all cached blocks back to the system.
+ */
+void cgPoolTrim(
+    void
+);
+
+/// Pool statistics.
+/**
+ * This function reads the pool counters.
+ * @param stats returned counters.
+ */
+void cgPoolGetStats(
+    cgPoolStats *stats
+);
+
+/// Create arena.
+/**
+ * This function creates an empty arena.
+ * @param chunk minimum chunk size in bytes.
+ * @return arena or NULL in error.
+ */
+cgArena cgCreateArena(
+    size_t chunk
+);
+
+/// Scratch arena.
+/**
+ * This function returns the arena of the calling thread, created on first
+ * use.
+ * @return arena or NULL in error.
+ */
+cgArena cgScratchArena(
+    void
+);
+
+/// Arena allocation.
+/**
+ * This function allocates a block from an arena, aligned to CG_POOL_ALIGN
+ * bytes. It lives until the arena is rewound past it.
+ * @param arena arena.
+ * @param size size in bytes.
+ * @return block or NULL in error.
+ */
+void *cgArenaAlloc(
+    cgArena arena,
+    size_t size
+);
+
+/// Arena mark.
+/**
+ * This function returns the current position of an arena.
+ * @param arena arena.
+ * @return position.
+ */
+size_t cgArenaMark(
+    cgArena arena
+);
+
+/// Arena rewind.
+/**
+ * This function frees every block allocated after a mark.
+ * @param arena arena.
+ * @param mark position returned by cgArenaMark.
+ */
+void cgArenaRewind(
+    cgArena arena,
+    size_t mark
+);
+
+/// Reset arena.
+/**
+ * This function frees every block of an arena and keeps its memory in one
+ * chunk for the next use.
+ * @param arena arena.
+ */
+void cgResetArena(
+    cgArena arena
+);
+
+/// Free arena.
+/**
+ * This function returns the memory of an arena to the pool.
+ * @param arena arena.
+ */
+void cgFreeArena(
+    cgArena arena
+);
+
+#endif /* _CGPOOL_H_ */
@@ -0,0 +1,273 @@
+/**
+ * @file cgSequence.c
+ * @brief Implementation of the image sequence functions.
+ */
+
+
+#include <ctype.h>
+#include <unistd.h>
+#include "cgSequence.h"
+#include "cgBatch.h"
+#include "cgTiledImage.h"
+
+
+/* First number tried by printf patterns. */
+#define FIRST_FRAME_MAX 1
+
+
+static int AppendOffset(
+    cgSequence seq,
+    int *capacity,
+    long offset
+)
+{
+    if (seq->count == *capacity)
+    {
+        int grown = (*capacity > 0) ? 2 * *capacity : 64;
+        long *p = (long*) realloc(seq->offsets, grown * sizeof(long));
+        if (p == NULL)
+            return CG_FALSE;
+        seq->offsets = p;
+        *capacity = grown;
+    }
+
+    seq->offsets[seq->count++] = offset;
+
+    return CG_TRUE;
+}
+
+/* Walks the headers of a PGM file, skipping each raw raster by its size.
+ * Plain (ASCII) files hold a single image. A truncated last image is
+ * dropped. */
+static int IndexPGMFile(
+    cgSequence seq,
+    const char *fname
+)
+{
+    int nr, nc, mv, type, c;
+    int capacity = 0;
+    long offset = 0, size, raster;
+
+    FILE *fp = fopen(fname, "r");
+    if (fp == NULL)
+    {
+        char str[PATH_MAX + 32];
+        snprintf(str, sizeof(str), "Unable to open file %s", fname);
+        cgError("cgOpenSequence", str);
+        return CG_FALSE;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    while (ParsePGMHeader(fp, &nr, &nc, &mv, &type) == CG_TRUE)
+    {
+        if (type != CG_IMAGE_TYPE_PGM_RAW)
+        {
+            if (seq->count == 0)
+                AppendOffset(seq, &capacity, offset);
+            break;
+        }
+
+        raster = (long) nr * nc * ((mv < 256) ? 1 : 2);
+        if (ftell(fp) + raster > size)
+            break;
+        if (!AppendOffset(seq, &capacity, offset))
+            break;
+        fseek(fp, raster, SEEK_CUR);
+
+        /* Whitespace after the last raster is not another image. */
+        do
+            c = fgetc(fp);
+        while (c != EOF && isspace(c));
+        if (c == EOF)
+            break;
+        ungetc(c, fp);
+        offset = ftell(fp);
+    }
+
+    fclose(fp);
+
+    if (seq->count == 0)
+    {
+        cgError("cgOpenSequence", "No images found.");
+        return CG_FALSE;
+    }
+
+    return CG_TRUE;
+}
+
+/* Whether a pattern has exactly one integer conversion (%d, %03d, %x...)
+ * and otherwise only %% escapes, so it is safe as a printf format. */
+static int IsFramePattern(
+    const char *pattern
+)
+{
+    const char *p;
+    int conversions = 0;
+
+    for (p = pattern; *p != '\0'; p++)
+    {
+        if (*p != '%')
+            continue;
+        if (*++p == '%')
+            continue;
+
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '\0' || strchr("diouxX", *p) == NULL)
+            return CG_FALSE;
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
+static int NoFrames(
+    const char *pattern,
+    const char *reason
+)
+{
+    char str[PATH_MAX + 32];
+
+    snprintf(str, sizeof(str), "%s %s", reason, pattern);
+    cgError("cgOpenSequence", str);
+
+    return CG_FALSE;
+}
+
+/* Numbered files from the first existing number among 0 and 1 up to the
+ * first missing one. */
+static int ExpandPattern(
+    cgSequence seq,
+    const char *pattern
+)
+{
+    char str[PATH_MAX];
+    int capacity = 0, first, k;
+
+    if (!IsFramePattern(pattern))
+        return NoFrames(pattern, "Pattern needs one integer conversion:");
+
+    for (first = 0; first <= FIRST_FRAME_MAX; first++)
+    {
+        snprintf(str, sizeof(str), pattern, first);
+        if (access(str, R_OK) == 0)
+            break;
+    }
+
+    if (first > FIRST_FRAME_MAX)
+        return NoFrames(pattern, "No files match");
+
+    for (k = first; ; k++)
+    {
+        snprintf(str, sizeof(str), pattern, k);
+        if (access(str, R_OK) != 0)
+            break;
+
+        if (seq->fileCount == capacity)
+        {
+            int grown = (capacity > 0) ? 2 * capacity : 64;
+            char **p = (char**) realloc(seq->files, grown * sizeof(char*));
+            if (p == NULL)
+                return CG_FALSE;
+            seq->files = p;
+            capacity = grown;
+        }
+        if ((seq->files[seq->fileCount] = strdup(str)) == NULL)
+            return CG_FALSE;
+        seq->fileCount++;
+    }
+
+    seq->count = seq->fileCount;
+
+    return CG_TRUE;
+}
+
+cgSequence cgOpenSequence(
+    const char *name
+)
+{
+    int ok;
+
+    cgSequence seq = (cgSequence) calloc(1, sizeof(struct cg_sequence));
+    if (seq == NULL)
+    {
+        cgError("cgOpenSequence", "No memory available.");
+        return NULL;
+    }
+
+    if (strchr(name, '%') != NULL)
+    {
+        ok = ExpandPattern(seq, name);
+    }
+    else if (name[0] == '@' || strpbrk(name, "*?[") != NULL)
+    {
+        char *arg = (char*) name;
+        seq->files = cgExpandBatchInputs(&arg, 1, &seq->fileCount);
+        seq->count = seq->fileCount;
+        ok = (seq->files != NULL && seq->count > 0);
+    }
+    else
+    {
+        seq->files = (char**) malloc(sizeof(char*));
+        ok = (seq->files != NULL && (seq->files[0] = strdup(name)) != NULL);
+        if (ok)
+        {
+            seq->fileCount = 1;
+            if (cgIsTiledImage(name))
+                seq->count = 1;
+            else
+                ok = IndexPGMFile(seq, name);
+        }
+    }
+
+    if (!ok)
+    {
+        cgCloseSequence(seq);
+        return NULL;
+    }
+
+    return seq;
+}
+
+int cgSequenceLength(
+    cgSequence seq
+)
+{
+    return seq->count;
+}
+
+cgMat2i cgReadSequenceFrame(
+    cgSequence seq,
+    int k
+)
+{
+    const char *fname;
+
+    if (k < 0 || k >= seq->count)
+    {
+        cgError("cgReadSequenceFrame", "Invalid frame.");
+        return NULL;
+    }
+
+    if (seq->offsets != NULL)
+        return cgReadPGMImageAt(seq->files[0], seq->offsets[k], NULL);
+
+    fname = seq->files[k];
+
+    return cgIsTiledImage(fname) ? cgReadTiledImage(fname) : cgReadPGMImageAt(fname, 0, NULL);
+}
+
+void cgCloseSequence(
+    cgSequence seq
+)
+{
+    if (seq == NULL)
+        return;
+
+    cgFreeBatchInputs(seq->files, seq->fileCount);
+    free(seq->offsets);
+    free(seq);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file cgSequence.h
+ * @brief Declaration of the image sequence functions.
+ *
+ * A sequence is an ordered list of frames of an animation. The frames come
+ * from a raw PGM file holding several images one after the other, from
+ * numbered files given by a printf pattern ("frame%03d.pgm"), or from a
+ * glob or a list file as accepted by cgExpandBatchInputs. Frames are read
+ * one at a time, so the sequence may be longer than memory.
+ */
+
+
+#ifndef _CGSEQUENCE_H_
+#define _CGSEQUENCE_H_
+
+
+/* Includes. */
+#include "cgImage.h"
+
+
+/* Types. */
+
+/// cgSequence
+/** An ordered list of frames.
+ */
+typedef struct cg_sequence
+{
+    /// Files.
+    /** One name per frame, or the single multi-image file. */
+    char **files;
+    /// Number of files.
+    int fileCount;
+    /// Offsets.
+    /** Byte offset of each frame in files[0]; NULL when every frame is a
+     * file. */
+    long *offsets;
+    /// Number of frames.
+    int count;
+
+} *cgSequence;
+
+
+/* Functions. */
+
+/// Open sequence.
+/**
+ * This function finds the frames of a sequence. A name with '%' is a printf
+ * pattern numbered from 0 or 1 up to the first missing file; a name with
+ * wildcards or starting with '@' is expanded by cgExpandBatchInputs; any
+ * other name is a PGM file, whose images are indexed by their offsets.
+ * @param name sequence name.
+ * @return sequence or NULL in error.
+ */
+cgSequence cgOpenSequence(
+    const char *name
+);
+
+/// Sequence length.
+/**
+ * This function returns the number of frames of a sequence.
+ * @param seq sequence.
+ * @return number of frames.
+ */
+int cgSequenceLength(
+    cgSequence seq
+);
+
+/// Read sequence frame.
+/**
+ * This function reads one frame of a sequence. It may be called from
+ * several threads at once.
+ * @param seq sequence.
+ * @param k frame index (from 0).
+ * @return gray-tone image or NULL in error.
+ */
+cgMat2i cgReadSequenceFrame(
+    cgSequence seq,
+    int k
+);
+
+/// Close sequence.
+/**
+ * This function frees a sequence.
+ * @param seq sequence.
+ */
+void cgCloseSequence(
+    cgSequence seq
+);
+
+#endif /* _CGSEQUENCE_H_ */
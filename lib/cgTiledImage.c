@@ -0,0 +1,590 @@
+/**
+ * @file cgTiledImage.c
+ * @brief Implementation of the tiled compressed image functions.
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cgTiledImage.h"
+#include "cgJobs.h"
+#include "cgPool.h"
+
+
+/* Sizes of the on-disk header and index entries. */
+#define HEADER_SIZE 32
+#define ENTRY_SIZE  20
+
+/* Largest encoded tile: a 10-byte varint per pixel. */
+#define TILE_BYTES(s) ((uint64_t) (s) * (s) * 10)
+
+/* Tile rows and columns per parallel block. */
+#define READ_GRAIN_TILES 2
+
+
+typedef struct cg_tiled_read_job
+{
+    cgTiledImage tim;
+    cgMat2i dst;
+    int r0;
+    int c0;
+    size_t maxSize;
+    int ok;
+
+} cgTiledReadJob;
+
+
+/* Token stream: a varint t where (t & 1) == 0 carries a zigzag encoded
+ * non-zero residual in t >> 1 and (t & 1) == 1 a run of t >> 1 zero
+ * residuals. Residuals are taken against the left pixel, or the one above
+ * for the first column; the first pixel of the tile is predicted by 0. */
+
+static unsigned char *PutVarint(
+    unsigned char *out,
+    uint64_t v
+)
+{
+    while (v >= 0x80)
+    {
+        *out++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char) v;
+
+    return out;
+}
+
+static const unsigned char *GetVarint(
+    const unsigned char *in,
+    const unsigned char *end,
+    uint64_t *v
+)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (in < end && shift < 64)
+    {
+        unsigned char b = *in++;
+        *v |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return in;
+        shift += 7;
+    }
+
+    return NULL;
+}
+
+static unsigned char *PutZeroRun(
+    unsigned char *out,
+    uint64_t run
+)
+{
+    return (run > 0) ? PutVarint(out, (run << 1) | 1) : out;
+}
+
+size_t cgEncodeTile(
+    cgMat2i img,
+    int r0,
+    int c0,
+    int th,
+    int tw,
+    unsigned char *out,
+    cgTileInfo *info
+)
+{
+    unsigned char *p = out;
+    uint64_t run = 0;
+    int64_t pred, d;
+    int r, c, v;
+
+    info->min = INT_MAX;
+    info->max = INT_MIN;
+
+    for (r = r0; r < r0 + th; r++)
+    {
+        for (c = c0; c < c0 + tw; c++)
+        {
+            v = cgMatAt2i(img, r, c);
+
+            if (v < info->min)
+                info->min = v;
+            if (v > info->max)
+                info->max = v;
+
+            if (c > c0)
+                pred = cgMatAt2i(img, r, c - 1);
+            else if (r > r0)
+                pred = cgMatAt2i(img, r - 1, c);
+            else
+                pred = 0;
+
+            d = (int64_t) v - pred;
+            if (d == 0)
+            {
+                run++;
+                continue;
+            }
+
+            p = PutZeroRun(p, run);
+            run = 0;
+            p = PutVarint(p, (((uint64_t) d << 1) ^ (uint64_t) (d >> 63)) << 1);
+        }
+    }
+    p = PutZeroRun(p, run);
+
+    return p - out;
+}
+
+int cgDecodeTile(
+    const unsigned char *data,
+    size_t size,
+    cgMat2i img,
+    int r0,
+    int c0,
+    int th,
+    int tw
+)
+{
+    const unsigned char *end = data + size;
+    uint64_t t, run = 0;
+    int64_t pred, d;
+    int r, c;
+
+    for (r = r0; r < r0 + th; r++)
+    {
+        for (c = c0; c < c0 + tw; c++)
+        {
+            if (c > c0)
+                pred = cgMatAt2i(img, r, c - 1);
+            else if (r > r0)
+                pred = cgMatAt2i(img, r - 1, c);
+            else
+                pred = 0;
+
+            if (run > 0)
+            {
+                run--;
+                cgMatAt2i(img, r, c) = (int) pred;
+                continue;
+            }
+
+            data = GetVarint(data, end, &t);
+            if (data == NULL)
+                return CG_FALSE;
+
+            if (t & 1)
+            {
+                run = (t >> 1) - 1;
+                cgMatAt2i(img, r, c) = (int) pred;
+            }
+            else
+            {
+                t >>= 1;
+                d = (int64_t) (t >> 1) ^ -(int64_t) (t & 1);
+                cgMatAt2i(img, r, c) = (int) (pred + d);
+            }
+        }
+    }
+
+    return (run == 0 && data == end) ? CG_TRUE : CG_FALSE;
+}
+
+int cgIsTiledImage(
+    const char *fname
+)
+{
+    uint32_t magic = 0;
+
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL)
+        return CG_FALSE;
+
+    if (fread(&magic, sizeof(magic), 1, fp) != 1)
+        magic = 0;
+    fclose(fp);
+
+    return (magic == CG_TILED_IMAGE_MAGIC) ? CG_TRUE : CG_FALSE;
+}
+
+cgTiledImage cgOpenTiledImage(
+    const char *fname
+)
+{
+    int32_t hdr[HEADER_SIZE / 4];
+    cgArena arena = cgScratchArena();
+    unsigned char *index;
+    size_t count, i, mark;
+    struct stat st;
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        cgError("cgOpenTiledImage", "Unable to open file.");
+        return NULL;
+    }
+
+    /* Header. */
+    if (fstat(fd, &st) != 0 ||
+        pread(fd, hdr, HEADER_SIZE, 0) != HEADER_SIZE ||
+        (uint32_t) hdr[0] != CG_TILED_IMAGE_MAGIC ||
+        hdr[1] != CG_TILED_IMAGE_VERSION ||
+        hdr[2] <= 0 || hdr[3] <= 0 || hdr[4] <= 0 ||
+        hdr[6] != (hdr[3] + hdr[4] - 1) / hdr[4] ||
+        hdr[7] != (hdr[2] + hdr[4] - 1) / hdr[4])
+    {
+        cgError("cgOpenTiledImage", "Invalid header.");
+        close(fd);
+        return NULL;
+    }
+
+    cgTiledImage tim = (cgTiledImage) cgPoolAlloc(sizeof(struct cg_tiled_image));
+    if (tim == NULL)
+    {
+        cgError("cgOpenTiledImage", "No memory available.");
+        close(fd);
+        return NULL;
+    }
+
+    tim->fd       = fd;
+    tim->height   = hdr[2];
+    tim->width    = hdr[3];
+    tim->tileSize = hdr[4];
+    tim->maxval   = hdr[5];
+    tim->tilesX   = hdr[6];
+    tim->tilesY   = hdr[7];
+
+    /* Tile index. */
+    count = (size_t) tim->tilesX * tim->tilesY;
+    tim->tiles = (cgTileInfo*) cgPoolAlloc(count * sizeof(cgTileInfo));
+    mark = (arena != NULL) ? cgArenaMark(arena) : 0;
+    index = (arena != NULL) ? (unsigned char*) cgArenaAlloc(arena, count * ENTRY_SIZE) : NULL;
+
+    if (tim->tiles == NULL || index == NULL ||
+        pread(fd, index, count * ENTRY_SIZE, HEADER_SIZE) != (ssize_t) (count * ENTRY_SIZE))
+    {
+        cgError("cgOpenTiledImage", "Invalid tile index.");
+        if (index != NULL)
+            cgArenaRewind(arena, mark);
+        cgPoolFree(tim->tiles);
+        cgPoolFree(tim);
+        close(fd);
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        memcpy(&tim->tiles[i].offset, index + i * ENTRY_SIZE,      8);
+        memcpy(&tim->tiles[i].size,   index + i * ENTRY_SIZE + 8,  4);
+        memcpy(&tim->tiles[i].min,    index + i * ENTRY_SIZE + 12, 4);
+        memcpy(&tim->tiles[i].max,    index + i * ENTRY_SIZE + 16, 4);
+
+        /* Entries past the end of the file or larger than any tile can
+         * encode to are corrupt. */
+        if (tim->tiles[i].offset > (uint64_t) st.st_size ||
+            tim->tiles[i].size > (uint64_t) st.st_size - tim->tiles[i].offset ||
+            tim->tiles[i].size > TILE_BYTES(tim->tileSize))
+            break;
+    }
+    cgArenaRewind(arena, mark);
+
+    if (i < count)
+    {
+        cgError("cgOpenTiledImage", "Invalid tile index.");
+        cgPoolFree(tim->tiles);
+        cgPoolFree(tim);
+        close(fd);
+        return NULL;
+    }
+
+    return tim;
+}
+
+void cgCloseTiledImage(
+    cgTiledImage tim
+)
+{
+    if (tim == NULL)
+        return;
+
+    close(tim->fd);
+    cgPoolFree(tim->tiles);
+    cgPoolFree(tim);
+}
+
+/* Decodes one tile into a scratch matrix holding the whole tile at its
+ * origin and copies the part inside the region to dst. Whole-image reads
+ * pass dst as the scratch so the copy is skipped. */
+static int ReadTile(
+    cgTiledImage tim,
+    int ty,
+    int tx,
+    cgMat2i scratch,
+    unsigned char *buf,
+    cgMat2i dst,
+    int r0,
+    int c0
+)
+{
+    const cgTileInfo *info = &tim->tiles[(size_t) ty * tim->tilesX + tx];
+    int tr = ty * tim->tileSize;
+    int tc = tx * tim->tileSize;
+    int th = tim->height - tr < tim->tileSize ? tim->height - tr : tim->tileSize;
+    int tw = tim->width - tc < tim->tileSize ? tim->width - tc : tim->tileSize;
+    int r, c;
+
+    if (pread(tim->fd, buf, info->size, info->offset) != (ssize_t) info->size)
+        return CG_FALSE;
+
+    /* Whole image: decode in place. */
+    if (scratch == dst)
+        return cgDecodeTile(buf, info->size, dst, tr, tc, th, tw);
+
+    if (cgDecodeTile(buf, info->size, scratch, 0, 0, th, tw) == CG_FALSE)
+        return CG_FALSE;
+
+    /* Copy the intersection with the region. */
+    for (r = tr; r < tr + th; r++)
+    {
+        if (r < r0 || r >= r0 + dst->height)
+            continue;
+        for (c = tc; c < tc + tw; c++)
+            if (c >= c0 && c < c0 + dst->width)
+                dst->val[r - r0][c - c0] = scratch->val[r - tr][c - tc];
+    }
+
+    return CG_TRUE;
+}
+
+static void ReadTilesBlock(
+    void *arg,
+    int ty0,
+    int ty1,
+    int tx0,
+    int tx1
+)
+{
+    cgTiledReadJob *job = (cgTiledReadJob*) arg;
+    cgTiledImage tim = job->tim;
+    int whole = (job->r0 == 0 && job->c0 == 0 &&
+                 job->dst->height == tim->height && job->dst->width == tim->width);
+    int tx, ty, ok = CG_TRUE;
+
+    /* Each block has its own buffers, so tiles decode independently. The
+     * compressed buffer is scratch of this thread. */
+    cgMat2i scratch = whole ? job->dst : cgAllocateMat2i(tim->tileSize, tim->tileSize);
+    cgArena arena = cgScratchArena();
+    size_t mark = (arena != NULL) ? cgArenaMark(arena) : 0;
+    unsigned char *buf = (arena != NULL) ? (unsigned char*) cgArenaAlloc(arena, job->maxSize > 0 ? job->maxSize : 1) : NULL;
+
+    if (scratch == NULL || buf == NULL)
+        ok = CG_FALSE;
+
+    for (ty = ty0; ok && ty < ty1; ty++)
+        for (tx = tx0; ok && tx < tx1; tx++)
+            ok = ReadTile(tim, ty, tx, scratch, buf, job->dst, job->r0, job->c0);
+
+    if (!ok)
+        __atomic_store_n(&job->ok, CG_FALSE, __ATOMIC_RELAXED);
+
+    if (arena != NULL)
+        cgArenaRewind(arena, mark);
+    if (!whole && scratch != NULL)
+        cgFreeMat2i(scratch);
+}
+
+cgMat2i cgReadTiledRegion(
+    cgTiledImage tim,
+    int r0,
+    int c0,
+    int height,
+    int width
+)
+{
+    cgTiledReadJob job;
+    size_t i;
+
+    if (r0 < 0 || c0 < 0 || height <= 0 || width <= 0 ||
+        r0 + height > tim->height || c0 + width > tim->width)
+    {
+        cgError("cgReadTiledRegion", "Invalid region.");
+        return NULL;
+    }
+
+    job.tim = tim;
+    job.r0 = r0;
+    job.c0 = c0;
+    job.ok = CG_TRUE;
+    job.maxSize = 0;
+    for (i = 0; i < (size_t) tim->tilesX * tim->tilesY; i++)
+        if (tim->tiles[i].size > job.maxSize)
+            job.maxSize = tim->tiles[i].size;
+
+    job.dst = cgAllocateMat2i(height, width);
+    if (job.dst == NULL)
+    {
+        cgError("cgReadTiledRegion", "No memory available.");
+        return NULL;
+    }
+    if (tim->maxval > 0)
+        job.dst->maxval = tim->maxval;
+
+    /* Only the tiles intersecting the region are read, in parallel. */
+    cgParallelFor2D(r0 / tim->tileSize, (r0 + height - 1) / tim->tileSize + 1,
+                    c0 / tim->tileSize, (c0 + width - 1) / tim->tileSize + 1,
+                    READ_GRAIN_TILES, READ_GRAIN_TILES, ReadTilesBlock, &job, NULL);
+
+    if (!job.ok)
+    {
+        cgError("cgReadTiledRegion", "Corrupt tile.");
+        cgFreeMat2i(job.dst);
+        return NULL;
+    }
+
+    return job.dst;
+}
+
+cgMat2i cgReadTiledImage(
+    const char *fname
+)
+{
+    cgTiledImage tim = cgOpenTiledImage(fname);
+    if (tim == NULL)
+        return NULL;
+
+    cgMat2i img = cgReadTiledRegion(tim, 0, 0, tim->height, tim->width);
+    cgCloseTiledImage(tim);
+
+    return img;
+}
+
+int cgWriteTiledImage(
+    cgMat2i img,
+    const char *fname,
+    int tileSize
+)
+{
+    int32_t hdr[HEADER_SIZE / 4];
+    cgArena arena = cgScratchArena();
+    unsigned char *buf, *entry;
+    cgTileInfo info;
+    uint64_t offset;
+    size_t len, mark;
+    int tx, ty, tilesX, tilesY, maxval, ok = CG_TRUE;
+
+    if (img == NULL)
+    {
+        cgError("cgWriteTiledImage", "NULL image.");
+        return CG_FALSE;
+    }
+
+    if (tileSize <= 0)
+        tileSize = CG_TILED_IMAGE_TILE;
+
+    tilesX = (img->width + tileSize - 1) / tileSize;
+    tilesY = (img->height + tileSize - 1) / tileSize;
+
+    FILE *fp = fopen(fname, "wb");
+    if (fp == NULL)
+    {
+        cgError("cgWriteTiledImage", "Unable to open file.");
+        return CG_FALSE;
+    }
+
+    mark  = (arena != NULL) ? cgArenaMark(arena) : 0;
+    buf   = (arena != NULL) ? (unsigned char*) cgArenaAlloc(arena, TILE_BYTES(tileSize)) : NULL;
+    entry = (arena != NULL) ? (unsigned char*) cgArenaAlloc(arena, (size_t) tilesX * tilesY * ENTRY_SIZE) : NULL;
+    if (buf == NULL || entry == NULL)
+    {
+        cgError("cgWriteTiledImage", "No memory available.");
+        if (arena != NULL)
+            cgArenaRewind(arena, mark);
+        fclose(fp);
+        return CG_FALSE;
+    }
+
+    /* Header. */
+    hdr[0] = (int32_t) CG_TILED_IMAGE_MAGIC;
+    hdr[1] = CG_TILED_IMAGE_VERSION;
+    hdr[2] = img->height;
+    hdr[3] = img->width;
+    hdr[4] = tileSize;
+    maxval = cgMatMaxValue2i(img);
+    hdr[5] = (maxval > img->maxval) ? maxval : img->maxval;
+    hdr[6] = tilesX;
+    hdr[7] = tilesY;
+    ok = fwrite(hdr, HEADER_SIZE, 1, fp) == 1;
+
+    /* Tile data follows the index, which is written last. */
+    offset = HEADER_SIZE + (uint64_t) tilesX * tilesY * ENTRY_SIZE;
+    ok = ok && fseek(fp, (long) offset, SEEK_SET) == 0;
+
+    for (ty = 0; ok && ty < tilesY; ty++)
+    {
+        for (tx = 0; ok && tx < tilesX; tx++)
+        {
+            int th = img->height - ty * tileSize < tileSize ? img->height - ty * tileSize : tileSize;
+            int tw = img->width - tx * tileSize < tileSize ? img->width - tx * tileSize : tileSize;
+            unsigned char *e = entry + ((size_t) ty * tilesX + tx) * ENTRY_SIZE;
+
+            len = cgEncodeTile(img, ty * tileSize, tx * tileSize, th, tw, buf, &info);
+            info.offset = offset;
+            info.size   = (uint32_t) len;
+
+            memcpy(e,      &info.offset, 8);
+            memcpy(e + 8,  &info.size,   4);
+            memcpy(e + 12, &info.min,    4);
+            memcpy(e + 16, &info.max,    4);
+
+            ok = fwrite(buf, 1, len, fp) == len;
+            offset += len;
+        }
+    }
+
+    /* Tile index. */
+    ok = ok && fseek(fp, HEADER_SIZE, SEEK_SET) == 0 &&
+         fwrite(entry, ENTRY_SIZE, (size_t) tilesX * tilesY, fp) == (size_t) tilesX * tilesY;
+
+    if (fclose(fp) != 0)
+        ok = CG_FALSE;
+
+    if (!ok)
+        cgError("cgWriteTiledImage", "Unable to write file.");
+
+    cgArenaRewind(arena, mark);
+
+    return ok ? CG_TRUE : CG_FALSE;
+}
+
+int cgConvertPGMToTiled(
+    const char *pgm,
+    const char *fname,
+    int tileSize
+)
+{
+    cgMat2i img = cgReadPGMImage(pgm);
+    if (img == NULL)
+        return CG_FALSE;
+
+    int ok = cgWriteTiledImage(img, fname, tileSize);
+    cgFreeMat2i(img);
+
+    return ok;
+}
+
+int cgConvertTiledToPGM(
+    const char *fname,
+    const char *pgm,
+    int type
+)
+{
+    cgMat2i img = cgReadTiledImage(fname);
+    if (img == NULL)
+        return CG_FALSE;
+
+    cgWritePGMImage(img, (char*) pgm, type);
+    cgFreeMat2i(img);
+
+    return CG_TRUE;
+}
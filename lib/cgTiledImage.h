@@ -0,0 +1,231 @@
+/**
+ * @file cgTiledImage.h
+ * @brief Declaration of the tiled compressed image functions.
+ *
+ * The container splits an image in a fixed grid of square tiles. Each tile
+ * is compressed on its own (delta prediction, zigzag varints and run-length
+ * coding of zero residuals) and listed in an offset index together with its
+ * minimum and maximum values, so tiles can be decoded in parallel and a
+ * region can be read without touching the rest of the file.
+ *
+ * File layout (little endian):
+ *   header | tile index (tilesY*tilesX entries, row-major) | tile data
+ */
+
+
+#ifndef _CGTILEDIMAGE_H_
+#define _CGTILEDIMAGE_H_
+
+
+/* Includes. */
+#include <stdint.h>
+#include "cgImage.h"
+
+
+/* Defines. */
+#define CG_TILED_IMAGE_MAGIC   0x49544743u /* "CGTI" */
+#define CG_TILED_IMAGE_VERSION 1
+#define CG_TILED_IMAGE_TILE    64
+
+
+/* Types. */
+
+/// cgTileInfo
+/** Index entry of a tile.
+ */
+typedef struct cg_tile_info
+{
+    /// Offset.
+    /** Offset of the compressed tile from the start of the file. */
+    uint64_t offset;
+    /// Size.
+    /** Size of the compressed tile in bytes. */
+    uint32_t size;
+    /// Minimum value.
+    /** Minimum pixel value of the tile. */
+    int32_t min;
+    /// Maximum value.
+    /** Maximum pixel value of the tile. */
+    int32_t max;
+
+} cgTileInfo;
+
+/// cgTiledImage
+/** An open tiled image file.
+ */
+typedef struct cg_tiled_image
+{
+    /// File descriptor.
+    /** Descriptor of the open file. */
+    int fd;
+    /// Number of rows.
+    /** Number of rows of the image. */
+    int height;
+    /// Number of columns.
+    /** Number of columns of the image. */
+    int width;
+    /// Tile size.
+    /** Number of rows and columns of a tile. */
+    int tileSize;
+    /// Maximum value.
+    /** Maximum value of the pixel format (at least the maximum pixel). */
+    int maxval;
+    /// Tiles per row.
+    /** Number of tile columns. */
+    int tilesX;
+    /// Tiles per column.
+    /** Number of tile rows. */
+    int tilesY;
+    /// Tile index.
+    /** Index entries, tilesY*tilesX in row-major order. */
+    cgTileInfo *tiles;
+
+} *cgTiledImage;
+
+
+/* Functions. */
+
+/// Check tiled image.
+/**
+ * This function checks whether a file starts with the tiled image magic.
+ * @param fname file name.
+ * @return CG_TRUE if it is a tiled image; CG_FALSE otherwise.
+ */
+int cgIsTiledImage(
+    const char *fname
+);
+
+/// Open tiled image.
+/**
+ * This function opens a tiled image and reads its header and tile index.
+ * @param fname file name.
+ * @return open image or NULL in error.
+ */
+cgTiledImage cgOpenTiledImage(
+    const char *fname
+);
+
+/// Close tiled image.
+/**
+ * This function closes a tiled image.
+ * @param tim image to be closed.
+ */
+void cgCloseTiledImage(
+    cgTiledImage tim
+);
+
+/// Read region.
+/**
+ * This function decodes only the tiles intersecting a region.
+ * @param tim open image.
+ * @param r0 first row of the region.
+ * @param c0 first column of the region.
+ * @param height number of rows of the region.
+ * @param width number of columns of the region.
+ * @return region as a new matrix or NULL in error.
+ */
+cgMat2i cgReadTiledRegion(
+    cgTiledImage tim,
+    int r0,
+    int c0,
+    int height,
+    int width
+);
+
+/// Read tiled image.
+/**
+ * This function reads a whole tiled image.
+ * @param fname file name.
+ * @return gray-tone image or NULL in error.
+ */
+cgMat2i cgReadTiledImage(
+    const char *fname
+);
+
+/// Write tiled image.
+/**
+ * This function writes an image as a tiled compressed file.
+ * @param img image to write.
+ * @param fname file name.
+ * @param tileSize tile size (CG_TILED_IMAGE_TILE if not positive).
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgWriteTiledImage(
+    cgMat2i img,
+    const char *fname,
+    int tileSize
+);
+
+/// Encode tile.
+/**
+ * This function compresses a tile of an image.
+ * @param img source image.
+ * @param r0 first row of the tile.
+ * @param c0 first column of the tile.
+ * @param th number of rows of the tile.
+ * @param tw number of columns of the tile.
+ * @param out output buffer (at least 10*th*tw bytes).
+ * @param info returned min and max (offset is not set).
+ * @return number of bytes written.
+ */
+size_t cgEncodeTile(
+    cgMat2i img,
+    int r0,
+    int c0,
+    int th,
+    int tw,
+    unsigned char *out,
+    cgTileInfo *info
+);
+
+/// Decode tile.
+/**
+ * This function decompresses a tile into a window of an image.
+ * @param data compressed tile.
+ * @param size size of the compressed tile.
+ * @param img destination image.
+ * @param r0 first row of the tile in img.
+ * @param c0 first column of the tile in img.
+ * @param th number of rows of the tile.
+ * @param tw number of columns of the tile.
+ * @return CG_TRUE if successfull; CG_FALSE if the data is corrupt.
+ */
+int cgDecodeTile(
+    const unsigned char *data,
+    size_t size,
+    cgMat2i img,
+    int r0,
+    int c0,
+    int th,
+    int tw
+);
+
+/// Convert PGM to tiled image.
+/**
+ * This function converts a PGM file to a tiled image file.
+ * @param pgm PGM file name.
+ * @param fname tiled image file name.
+ * @param tileSize tile size (CG_TILED_IMAGE_TILE if not positive).
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgConvertPGMToTiled(
+    const char *pgm,
+    const char *fname,
+    int tileSize
+);
+
+/// Convert tiled image to PGM.
+/**
+ * This function converts a tiled image file to a PGM file.
+ * @param fname tiled image file name.
+ * @param pgm PGM file name.
+ * @param type PGM type (CG_IMAGE_TYPE_PGM_ASCII or CG_IMAGE_TYPE_PGM_RAW).
+ * @return CG_TRUE if successfull; CG_FALSE otherwise.
+ */
+int cgConvertTiledToPGM(
+    const char *fname,
+    const char *pgm,
+    int type
+);
+
+#endif /* _CGTILEDIMAGE_H_ */
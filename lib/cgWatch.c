@@ -0,0 +1,89 @@
+/**
+ * @file cgWatch.c
+ * @brief Implementation of the file watch functions.
+ */
+
+
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include "cgImage.h"
+#include "cgWatch.h"
+
+
+cgWatch cgOpenWatch(
+    const char *fname
+)
+{
+    char *dirCopy, *baseCopy;
+
+    cgWatch watch = (cgWatch) malloc(sizeof(struct cg_watch));
+    if (watch == NULL)
+    {
+        cgError("cgOpenWatch", "No memory available.");
+        return NULL;
+    }
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0)
+    {
+        cgError("cgOpenWatch", "Unable to create watch.");
+        free(watch);
+        return NULL;
+    }
+
+    /* dirname and basename may modify their argument. */
+    dirCopy  = strdup(fname);
+    baseCopy = strdup(fname);
+    watch->name = strdup(basename(baseCopy));
+
+    /* Writes end with IN_CLOSE_WRITE; atomic replaces with IN_MOVED_TO. */
+    if (inotify_add_watch(watch->fd, dirname(dirCopy), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        cgError("cgOpenWatch", "Unable to watch directory.");
+        close(watch->fd);
+        free(watch->name);
+        free(watch);
+        watch = NULL;
+    }
+
+    free(dirCopy);
+    free(baseCopy);
+
+    return watch;
+}
+
+int cgPollWatch(
+    cgWatch watch
+)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    int changed = CG_FALSE;
+    ssize_t len;
+    char *p;
+
+    while ((len = read(watch->fd, buf, sizeof(buf))) > 0)
+    {
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+        {
+            ev = (const struct inotify_event*) p;
+            if (ev->len > 0 && strcmp(ev->name, watch->name) == 0)
+                changed = CG_TRUE;
+        }
+    }
+
+    return changed;
+}
+
+void cgCloseWatch(
+    cgWatch watch
+)
+{
+    if (watch == NULL)
+        return;
+
+    close(watch->fd);
+    free(watch->name);
+    free(watch);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file cgWatch.h
+ * @brief Declaration of the file watch functions.
+ *
+ * A watch reports when a file has been rewritten. The parent directory is
+ * watched (inotify), so files replaced by rename are noticed as well.
+ */
+
+
+#ifndef _CGWATCH_H_
+#define _CGWATCH_H_
+
+
+/* Types. */
+
+/// cgWatch
+/** A watch on a single file.
+ */
+typedef struct cg_watch
+{
+    /// Descriptor.
+    /** Non-blocking inotify descriptor. */
+    int fd;
+    /// File name.
+    /** Name of the file inside the watched directory. */
+    char *name;
+
+} *cgWatch;
+
+
+/* Functions. */
+
+/// Open file watch.
+/**
+ * This function starts watching a file.
+ * @param fname file name.
+ * @return watch or NULL in error.
+ */
+cgWatch cgOpenWatch(
+    const char *fname
+);
+
+/// Poll file watch.
+/**
+ * This function consumes the pending events without blocking.
+ * @param watch watch.
+ * @return CG_TRUE if the file was written or replaced; CG_FALSE otherwise.
+ */
+int cgPollWatch(
+    cgWatch watch
+);
+
+/// Close file watch.
+/**
+ * This function stops watching a file.
+ * @param watch watch.
+ */
+void cgCloseWatch(
+    cgWatch watch
+);
+
+#endif /* _CGWATCH_H_ */
@@ -7,62 +7,110 @@
  * @author Ricardo Dutra da Silva
  */
 
+#include <string>
+#include <vector>
+#include <unistd.h>
 #include "utils.h"
+#include "cgMeshCache.h"
 
 
-/** 
- * Create program.
+/** Magic of the program binary files. */
+#define PROGRAM_CACHE_MAGIC "CGPROG1"
+
+/** Header of a program binary file, followed by the key and the binary. */
+struct ProgramCacheHeader
+{
+    char magic[8];
+    uint32_t keyLength;
+    uint32_t format;
+    uint32_t binaryLength;
+};
+
+
+/**
+ * Check shader.
+ *
+ * Prints the whole info log of a shader that failed to compile.
+ *
+ * @param shader Shader.
+ * @return True if the shader compiled.
+ */
+static bool checkShader(int shader)
+{
+    int success, length;
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        std::string error(length > 0 ? length : 1, '\0');
+        glGetShaderInfoLog(shader, error.size(), NULL, &error[0]);
+        std::cout << "ERROR: Shader comilation error: " << error.c_str() << std::endl;
+    }
+
+    return success;
+}
+
+/**
+ * Check program.
+ *
+ * Prints the whole info log of a program that failed to link.
+ *
+ * @param program Program.
+ * @return True if the program linked.
+ */
+static bool checkProgram(int program)
+{
+    int success, length;
+
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        std::string error(length > 0 ? length : 1, '\0');
+        glGetProgramInfoLog(program, error.size(), NULL, &error[0]);
+        std::cout << "ERROR: Program link error: " << error.c_str() << std::endl;
+    }
+
+    return success;
+}
+
+/**
+ * Compile program.
  *
- * Creates a program from given shader codes.
+ * Compiles and links a program from given shader codes.
  *
  * @param vertex_code String with code for vertex shader.
  * @param fragment_code String with code for fragment shader.
- * @return Compiled program.
+ * @param retrievable Whether the binary will be read back.
+ * @return Linked program, or 0 in error.
  */
-int createShaderProgram(const char *vertex_code, const char *fragment_code)
+static int compileShaderProgram(const char *vertex_code, const char *fragment_code, bool retrievable)
 {
-	
-    int success;
-    char error[512];
-
     // Request a program and shader slots from GPU
     int program  = glCreateProgram();
     int vertex   = glCreateShader(GL_VERTEX_SHADER);
     int fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    
+
     // Set shaders source
     glShaderSource(vertex, 1, &vertex_code, NULL);
     glShaderSource(fragment, 1, &fragment_code, NULL);
 
     // Compile shaders
     glCompileShader(vertex);
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-	glGetShaderInfoLog(vertex, 512, NULL, error);
-	std::cout << "ERROR: Shader comilation error: " << error << std::endl;
-    }
-                
+    checkShader(vertex);
     glCompileShader(fragment);
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-	glGetShaderInfoLog(fragment, 512, NULL, error);
-	std::cout << "ERROR: Shader comilation error: " << error << std::endl;
-    }
+    checkShader(fragment);
 
     // Attach shader objects to the program
     glAttachShader(program, vertex);
     glAttachShader(program, fragment);
 
     // Build program
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
-    glGetShaderiv(program, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-	glGetProgramInfoLog(program, 512, NULL, error);
-	std::cout << "ERROR: Program link error: " << error << std::endl;
-    }
+    bool linked = checkProgram(program);
 
     // Get rid of shaders (not needed anymore)
     glDetachShader(program, vertex);
@@ -70,5 +118,171 @@ int createShaderProgram(const char *vertex_code, const char *fragment_code)
     glDeleteShader(vertex);
     glDeleteShader(fragment);
 
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+/**
+ * Program key.
+ *
+ * A binary is only valid for the same sources on the same driver, so the
+ * key holds both.
+ *
+ * @param vertex_code String with code for vertex shader.
+ * @param fragment_code String with code for fragment shader.
+ * @return Key.
+ */
+static std::string programKey(const char *vertex_code, const char *fragment_code)
+{
+    GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    std::string key;
+
+    for (GLenum name : names)
+    {
+        const GLubyte *value = glGetString(name);
+        if (value != NULL)
+            key += (const char *)value;
+        key += '\n';
+    }
+    key += vertex_code;
+    key += '\0';
+    key += fragment_code;
+
+    return key;
+}
+
+/**
+ * Load program binary.
+ *
+ * Creates a program from a cached binary whose key matches.
+ *
+ * @param path Cache file name.
+ * @param key Program key.
+ * @return Linked program, or 0 if missing, stale or rejected by the driver.
+ */
+static int loadProgramBinary(const std::string &path, const std::string &key)
+{
+    ProgramCacheHeader header;
+    std::string stored;
+    std::vector<char> binary;
+    bool ok;
+
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return 0;
+
+    ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+         memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+         header.keyLength == key.size();
+    if (ok)
+    {
+        stored.resize(header.keyLength);
+        binary.resize(header.binaryLength);
+        ok = fread(&stored[0], 1, stored.size(), fp) == stored.size() && stored == key &&
+             fread(binary.data(), 1, binary.size(), fp) == binary.size();
+    }
+    fclose(fp);
+    if (!ok)
+        return 0;
+
+    // The driver may still refuse it (e.g. after an update that kept the
+    // version string)
+    int program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), binary.size());
+
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+/**
+ * Store program binary.
+ *
+ * Writes the binary of a linked program to the cache, through a temporary
+ * file so that concurrent runs never read a partial one.
+ *
+ * @param program Linked program.
+ * @param path Cache file name.
+ * @param key Program key.
+ */
+static void storeProgramBinary(int program, const std::string &path, const std::string &key)
+{
+    int length = 0;
+    GLenum format;
+
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    ProgramCacheHeader header;
+    memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+    header.keyLength = key.size();
+    header.format = format;
+    header.binaryLength = length;
+
+    std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (fp == NULL)
+        return;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(key.data(), 1, key.size(), fp) == key.size() &&
+              fwrite(binary.data(), 1, length, fp) == (size_t)length;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        unlink(tmp.c_str());
+}
+
+
+/**
+ * Create program.
+ *
+ * Creates a program from given shader codes. When the driver can save
+ * program binaries, the linked program is kept in the cache directory and
+ * reused by later runs with the same sources, vendor, renderer and version;
+ * otherwise, or on any mismatch, the sources are compiled.
+ *
+ * @param vertex_code String with code for vertex shader.
+ * @param fragment_code String with code for fragment shader.
+ * @return Compiled program.
+ */
+int createShaderProgram(const char *vertex_code, const char *fragment_code)
+{
+    char dir[PATH_MAX];
+    int formats = 0;
+
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0 || !cgCacheDirectory(dir, sizeof(dir)))
+        return compileShaderProgram(vertex_code, fragment_code, false);
+
+    std::string key = programKey(vertex_code, fragment_code);
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.glprog", (unsigned long long)cgHash64(key.data(), key.size(), 0));
+    std::string path = std::string(dir) + name;
+
+    int program = loadProgramBinary(path, key);
+    if (program != 0)
+        return program;
+
+    program = compileShaderProgram(vertex_code, fragment_code, true);
+    if (program != 0)
+        storeProgramBinary(program, path, key);
+
     return program;
 }
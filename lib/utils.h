@@ -15,7 +15,8 @@
 /** 
  * Create program.
  *
- * Creates a program from given shader codes.
+ * Creates a program from given shader codes. Linked programs are cached
+ * on disk (glGetProgramBinary) and reused while sources and driver match.
  *
  * @param vertex_code String with code for vertex shader.
  * @param fragment_code String with code for fragment shader.
@@ -1,4 +1,5 @@
 #include <bits/stdc++.h>
+#include <sys/stat.h>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <glm/glm.hpp>
@@ -6,6 +7,18 @@
 #include <glm/gtc/type_ptr.hpp>
 #include "lib/utils.h"
 #include "lib/cgImage.h"
+#include "lib/cgMeshCache.h"
+#include "lib/cgTiledImage.h"
+#include "lib/cgMesh.h"
+#include "lib/cgWatch.h"
+#include "lib/cgFilter.h"
+#include "lib/cgJobs.h"
+#include "lib/cgBatch.h"
+#include "lib/cgExport.h"
+#include "lib/cgSequence.h"
+#include "lib/cgContour.h"
+#include "lib/cgInputLog.h"
+#include "lib/cgPool.h"
 using namespace std;
 
 // Modos de operação do programa
@@ -13,6 +26,9 @@ using namespace std;
 #define TRANSLATION 1
 #define SCALE 2
 
+// Intervalo de verificação de mudanças na imagem (ms)
+#define RELOAD_INTERVAL 50
+
 // Tamanho da janela
 int win_width = 800;
 int win_height = 600;
@@ -21,43 +37,241 @@ int wwidth;
 int hheight;
 int area;
 int type_primitive = GL_TRIANGLES;
-float *vertices;
-int current = 0;
+void *vertices;
+cgMat2i image = NULL;
+cgMeshCache meshCache = NULL;
+cgWatch watch = NULL;
+char *imageName;
+const char *filters = "";
+int layout = CG_LAYOUT_ROW_MAJOR;
+
+// Modo de relevo (malha indexada deslocada pela intensidade)
+bool heightMode = false;
+float heightScale = 0.25;
+uint32_t *indices = NULL;
+size_t indexCount = 0;
+
+// Nuvem de pontos esparsa: só os pixels da janela de intensidade (e da
+// amostragem) vão para o buffer, compactados
+bool pointCloud = false;
+cgPointFilter pointFilter = {0, 255, 1, 1.0f, 1};
+size_t pointCount = 0;
+size_t pointCapacity = 0;
+
+void rebuildPoints();
+
+// Isolinhas: só as curvas de nível vão para o buffer, como GL_LINES, e a
+// geometria acompanha o comprimento das curvas, não a área
+bool isolines = false;
+vector<float> isoLevels;
+size_t lineVertexCount = 0;
+
+void rebuildIsolines();
+
+// Gravação e reprodução das entradas (teclas e tamanho da janela), com o
+// tempo de cada quadro na reprodução
+struct FrameTime {
+    double time;   // ms desde o início
+    double draw;   // ms do desenho, até a GPU terminar
+    int events;    // eventos aplicados até o quadro
+};
+
+cgInputLog inputLog = NULL;
+chrono::steady_clock::time_point sessionStart;
+cgInputEvent *replayEvents = NULL;
+int replayCount = 0;
+int replayNext = 0;
+bool replayFast = false;
+const char *replayName = NULL;
+vector<FrameTime> frameTimes;
+
+// Janela de intensidade e mapa de cores: as intensidades vão para a GPU
+// como uint16 normalizado e a cor sai de uma textura 1D no fragment shader,
+// então contraste e mapa mudam sem refazer a malha
+#define LUT_SIZE 256
+
+const char *colorMapNames[] = {"cinza", "quente", "arco-íris"};
+int colorMap = 0;
+int imageMaxval = 255;
+float windowLow = 0.0;   // limites em [0, 1] (intensidade / maxval)
+float windowHigh = 1.0;
+float windowArg[2] = {-1, -1};  // -W, em unidades da imagem
+unsigned int lutTexture;
+
+// Arquivo gerado pela tecla de exportação
+const char *exportName = "malha.ply";
+
+// Várias imagens lado a lado em um único buffer: cada uma é um comando de
+// desenho e tem sua posição na tabela de transformações (UBO)
+#define MAX_IMAGES 256
+
+struct ImageSlot {
+    char *name;
+    cgMat2i image;
+    void *vertices;
+    uint32_t *indices;
+    size_t indexCount;
+    size_t vertexCount;
+    GLint baseVertex;
+    GLuint firstIndex;
+};
+
+// Comandos de glMultiDrawArraysIndirect e glMultiDrawElementsIndirect
+struct DrawArraysCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+struct DrawElementsCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+vector<ImageSlot> slots;
+bool multiDraw = false;
+unsigned int UBO;
+unsigned int IBO;
+unsigned int instanceVBO;
+size_t elementsCommandOffset;
+
+// Animação: o quadro seguinte é decodificado em uma tarefa enquanto o atual
+// é mostrado; três buffers se alternam (um na tela, um pronto e um sendo
+// escrito) para que o desenho nunca espere pela decodificação
+#define PLAYBACK_SLOTS 3
+
+enum { SLOT_FREE, SLOT_DECODING, SLOT_READY, SLOT_SHOWN };
+
+struct FrameSlot {
+    unsigned int VAO;
+    unsigned int VBO;
+    void *mapped;      // mapeamento persistente, ou NULL
+    void *staging;     // cópia na CPU quando não há mapeamento
+    GLsync fence;      // último desenho que leu o buffer
+    int state;
+    int frame;
+    int serial;
+    bool ok;
+    double decodeMs;
+};
+
+cgSequence sequence = NULL;
+FrameSlot frameSlots[PLAYBACK_SLOTS];
+cgTaskGroup decodeGroup;
+int shownSlot = -1;
+int decodingSlot = -1;
+int nextFrame = 0;
+int nextSerial = 0;
+bool persistentMap = false;
+bool paused = false;
+float playbackRate = 0.0;  // quadros/s; 0 é o mais rápido possível
 
 // Variáveis de configuração do OpenGL
 int program;
 unsigned int VAO;
 unsigned int VBO;
-/** Vertex shader. */
+unsigned int EBO;
+unsigned int viewUBO;
+
+// Estado da visualização comum aos shaders (UBO), enviado só quando muda
+#define VIEW_BLOCK \
+    "layout (std140) uniform View { mat4 transform; mat4 normalMatrix; vec2 window; float heightScale; };\n"
+
+/** Vertex shader. A posição de cada imagem vem da tabela, pelo atributo por instância. */
 const char *vertex_code =
     "\n"
     "#version 330 core\n"
-    "layout (location = 0) in vec3 position;\n"
-    "layout (location = 1) in vec3 color;\n"
+    "layout (location = 0) in vec2 position;\n"
+    "layout (location = 1) in float value;\n"
+    "layout (location = 2) in float image;\n"
     "\n"
-    "out vec3 vColor;\n"
+    "out float vValue;\n"
+    "out float vShade;\n"
     "\n"
-    "uniform mat4 transform;\n"
+    VIEW_BLOCK
+    "layout (std140) uniform Images { mat4 place[256]; };\n"
     "\n"
     "void main()\n"
     "{\n"
-    "    gl_Position = transform * vec4(position, 1.0);\n"
-    "    vColor = color;\n"
+    "    gl_Position = transform * place[int(image)] * vec4(position, 0.0, 1.0);\n"
+    "    vValue = value;\n"
+    "    vShade = 1.0;\n"
     "}\0";
 
-/** Fragment shader. */
+/** Fragment shader: a janela leva a intensidade a [0, 1] e o mapa dá a cor. */
 const char *fragment_code =
     "\n"
     "#version 330 core\n"
     "\n"
-    "in vec3 vColor;\n"
+    "in float vValue;\n"
+    "in float vShade;\n"
     "out vec4 FragColor;\n"
     "\n"
+    "uniform sampler1D colorMap;\n"
+    VIEW_BLOCK
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    float t = clamp((vValue - window.x) / (window.y - window.x), 0.0, 1.0);\n"
+    "    FragColor = vec4(texture(colorMap, t).rgb * vShade, 1.0f);\n"
+    "}\0";
+
+/** Vertex shader do relevo: z é a intensidade e a normal vem compactada. */
+const char *height_vertex_code =
+    "\n"
+    "#version 330 core\n"
+    "layout (location = 0) in vec3 position;\n"
+    "layout (location = 1) in vec4 normal;\n"
+    "layout (location = 2) in float image;\n"
+    "\n"
+    "out float vValue;\n"
+    "out float vShade;\n"
+    "\n"
+    VIEW_BLOCK
+    "layout (std140) uniform Images { mat4 place[256]; };\n"
+    "\n"
+    "const vec3 light = vec3(0.267, 0.534, 0.802);\n"
+    "\n"
     "void main()\n"
     "{\n"
-    "    FragColor = vec4(vColor, 1.0f);\n"
+    "    gl_Position = transform * place[int(image)] * vec4(position.xy, position.z * heightScale, 1.0);\n"
+    "    vec3 n = normalize(mat3(normalMatrix) * normal.xyz);\n"
+    "    float diffuse = max(dot(n, light), 0.0);\n"
+    "    vValue = position.z;\n"
+    "    vShade = 0.3 + 0.7 * diffuse;\n"
     "}\0";
 
+// Variantes de shader dos modos de desenho. Cada programa é criado na
+// primeira vez que é pedido (do cache de binários, quando possível)
+struct ShaderVariant {
+    const char *name;
+    const char *vertex;
+    const char *fragment;
+    int program;
+};
+
+ShaderVariant shaderVariants[] = {
+    {"flat", vertex_code, fragment_code, 0},
+    {"height", height_vertex_code, fragment_code, 0},
+};
+
+// Programa de uma variante pelo nome
+int shaderProgram(const char *name) {
+    for (ShaderVariant &variant : shaderVariants) {
+        if (strcmp(variant.name, name) != 0)
+            continue;
+        if (variant.program == 0)
+            variant.program = createShaderProgram(variant.vertex, variant.fragment);
+        return variant.program;
+    }
+    cerr << "Shader desconhecido: " << name << endl;
+    return 0;
+}
+
 // Para controlar rotação, translação e escala
 int mode = ROTATION;
 float scaleX = 1.0;
@@ -68,14 +282,8 @@ float translationX = 0.0;
 float translationY = 0.0;
 float translationZ = 0.0;
 
-// Renderiza os vértices na tela
-void display() {
-    glClearColor(0.241, 0.086, 0.206, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    glUseProgram(program);
-    glBindVertexArray(VAO);
-
+// Transformação atual do modelo
+glm::mat4 modelMatrix() {
     // Translation.
     glm::mat4 T = glm::translate(glm::mat4(1.0f), glm::vec3(translationX, translationY, translationZ));
     // Rotation around z-axis.
@@ -84,24 +292,286 @@ void display() {
     glm::mat4 S = glm::scale(glm::mat4(1.0f), glm::vec3(scaleX, scaleY, scaleZ));
 
     // M = T*R*S.
-    glm::mat4 M = T * Rz * S;
+    return T * Rz * S;
+}
+
+// Tudo o que define a imagem na tela além do conteúdo dos buffers
+struct ViewState {
+    float scaleX, scaleY, scaleZ;
+    float translationX, translationY, translationZ;
+    int rotation;
+    float windowLow, windowHigh;
+    float heightScale;
+    int primitive;
+    int width, height;
+};
+
+// Bloco View do shader, em std140 (a mat3 ocupa uma mat4)
+struct ViewUniforms {
+    glm::mat4 transform;
+    glm::mat4 normalMatrix;
+    glm::vec2 window;
+    float heightScale;
+    float pad;
+};
+
+// Medidas do agendamento dos quadros
+struct RenderStats {
+    int requests;      // pedidos de quadro (teclas, recargas, ...)
+    int coalesced;     // juntados a um quadro já agendado
+    int skipped;       // que não mudavam nada na tela
+    int frames;        // quadros desenhados
+    double draw;       // ms de desenho, somados
+    double drawMax;
+    double wait;       // ms do primeiro pedido até o quadro, somados
+    double waitMax;
+};
+
+// Agendamento: um pedido marca a tela como suja e agenda um quadro para o
+// próximo intervalo de quadro (vsync); os pedidos até lá, como os de uma
+// tecla repetida, viram esse mesmo quadro, e os que não mudam nada são
+// ignorados
+float frameRate = 60.0;  // -F; 0 desenha a cada pedido
+bool redrawPending = false;
+bool contentDirty = true;
+int frameSerial = 0;
+ViewState drawnView;
+ViewState uploadedView;
+RenderStats renderStats;   // do último segundo
+RenderStats renderTotal;   // da sessão
+bool renderStatsScheduled = false;
+chrono::steady_clock::time_point lastFrame;
+chrono::steady_clock::time_point firstRequest;
+
+ViewState currentView() {
+    ViewState v = {scaleX, scaleY, scaleZ, translationX, translationY, translationZ, rotation,
+                   windowLow, windowHigh, heightScale, type_primitive, win_width, win_height};
+    return v;
+}
+
+// Recalcula as matrizes e envia o bloco View
+void uploadView(const ViewState &view) {
+    ViewUniforms u;
+    u.transform = modelMatrix();
+    // Normais seguem a inversa transposta do modelo
+    u.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(u.transform))));
+    u.window = glm::vec2(view.windowLow, view.windowHigh);
+    u.heightScale = view.heightScale;
+    u.pad = 0.0f;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, viewUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ViewUniforms), &u);
+    uploadedView = view;
+}
+
+// Cria o bloco View (ponto 1; a tabela de imagens usa o 0)
+void initViewBuffer() {
+    glGenBuffers(1, &viewUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, viewUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, viewUBO);
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "View"), 1);
+    uploadView(currentView());
+}
+
+// Quadro agendado (descartado se outro quadro já foi desenhado)
+void frameTimer(int serial) {
+    if (serial == frameSerial && redrawPending)
+        glutPostRedisplay();
+}
+
+// Pede um quadro: content indica que os buffers ou a textura mudaram
+void requestRedraw(bool content) {
+    ViewState view = currentView();
+    renderStats.requests++;
+    renderTotal.requests++;
+    contentDirty = contentDirty || content;
+
+    if (redrawPending) {
+        renderStats.coalesced++;
+        renderTotal.coalesced++;
+        return;
+    }
+    if (!contentDirty && memcmp(&view, &drawnView, sizeof(ViewState)) == 0) {
+        renderStats.skipped++;
+        renderTotal.skipped++;
+        return;
+    }
+
+    redrawPending = true;
+    firstRequest = chrono::steady_clock::now();
+    double wait = frameRate > 0 ? 1000.0 / frameRate - chrono::duration<double, milli>(firstRequest - lastFrame).count() : 0.0;
+    if (wait <= 0)
+        glutPostRedisplay();
+    else
+        glutTimerFunc((unsigned)ceil(wait), frameTimer, ++frameSerial);
+}
+
+void countFrame(RenderStats &stats, double draw, double wait) {
+    stats.frames++;
+    stats.draw += draw;
+    stats.drawMax = max(stats.drawMax, draw);
+    stats.wait += wait;
+    stats.waitMax = max(stats.waitMax, wait);
+}
+
+void printRenderStats(const char *title, const RenderStats &stats) {
+    int frames = max(stats.frames, 1);
+    cout << title << stats.frames << " quadros, " << stats.requests << " pedidos (" << stats.coalesced << " agrupados, "
+         << stats.skipped << " sem mudança), desenho " << stats.draw / frames << " ms (máx " << stats.drawMax
+         << "), espera " << stats.wait / frames << " ms (máx " << stats.waitMax << ")" << endl;
+}
+
+// Mostra as medidas do último segundo com quadros
+void showRenderStats(int value) {
+    (void)value;
+    printRenderStats("Quadros: ", renderStats);
+    memset(&renderStats, 0, sizeof(RenderStats));
+    renderStatsScheduled = false;
+}
+
+// Grava a malha atual em PLY, OBJ ou STL (pela extensão), com ou sem a
+// transformação do modelo
+bool exportMesh(const char *fileName, const float *transform) {
+    int type = cgExportTypeFromName(fileName);
+    if (type == CG_EXPORT_UNKNOWN) {
+        cerr << "Formato desconhecido: " << fileName << " (use .ply, .obj ou .stl)" << endl;
+        return false;
+    }
+
+    cgExportMesh mesh;
+    mesh.format = heightMode ? CG_MESH_FORMAT_HEIGHT : CG_MESH_FORMAT_FLAT;
+    mesh.vertices = vertices;
+    mesh.vertexCount = heightMode ? (size_t)area : (size_t)area * 6;
+    mesh.indices = indices;
+    mesh.indexCount = indexCount;
+    mesh.heightScale = heightScale;
+
+    auto start = chrono::steady_clock::now();
+    if (!cgWriteMeshFile(&mesh, transform, fileName, type))
+        return false;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    struct stat st;
+    double mb = (stat(fileName, &st) == 0) ? st.st_size / 1e6 : 0.0;
+    cout << "Exportado " << fileName << ": " << mb << " MB em " << seconds << " s (" << mb / seconds << " MB/s)" << endl;
+    return true;
+}
+
+// Desenha todas as imagens: uma única chamada com comandos indiretos, ou
+// uma chamada por imagem quando não há suporte
+void drawImages() {
+    bool points = type_primitive == GL_POINTS;
+    bool elements = heightMode && !points;
+    GLsizei count = slots.size();
+
+    if (multiDraw) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, IBO);
+        if (elements)
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)elementsCommandOffset, count, 0);
+        else
+            glMultiDrawArraysIndirect(type_primitive, (void *)0, count, 0);
+        return;
+    }
+
+    // O índice da imagem vai como valor constante do atributo
+    for (GLsizei i = 0; i < count; i++) {
+        glVertexAttrib1f(2, (float)i);
+        if (elements)
+            glDrawElementsBaseVertex(GL_TRIANGLES, slots[i].indexCount, GL_UNSIGNED_INT,
+                                     (void *)(sizeof(uint32_t) * slots[i].firstIndex), slots[i].baseVertex);
+        else
+            glDrawArrays(type_primitive, slots[i].baseVertex, slots[i].vertexCount);
+    }
+}
+
+// Microssegundos desde o início da sessão
+uint64_t sessionTime() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - sessionStart).count();
+}
 
-    // Retrieve location of tranform variable in shader.
-    unsigned int loc = glGetUniformLocation(program, "transform");
-    // Send matrix to shader.
-    glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(M));
+// Grava um evento, se houver gravação
+void recordInput(int type, int key, int width, int height) {
+    if (inputLog == NULL)
+        return;
+    cgInputEvent e = {sessionTime(), type, key, width, height};
+    if (!cgRecordInput(inputLog, &e)) {
+        cgCloseInputLog(inputLog);
+        inputLog = NULL;
+    }
+}
+
+// Renderiza os vértices na tela
+void display() {
+    auto frameStart = chrono::steady_clock::now();
+    double wait = redrawPending ? chrono::duration<double, milli>(frameStart - firstRequest).count() : 0.0;
+    redrawPending = false;
+    contentDirty = false;
+    drawnView = currentView();
+
+    glClearColor(0.241, 0.086, 0.206, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glUseProgram(program);
+    glBindVertexArray(sequence != NULL ? frameSlots[shownSlot].VAO : VAO);
+
+    // Matrizes e janela só são refeitas e enviadas quando mudam
+    if (memcmp(&drawnView, &uploadedView, sizeof(ViewState)) != 0)
+        uploadView(drawnView);
+
+    if (!slots.empty())
+        drawImages();
+    else if (pointCloud)
+        glDrawArrays(GL_POINTS, 0, pointCount);
+    else if (isolines)
+        glDrawArrays(GL_LINES, 0, lineVertexCount);
+    else if (heightMode) {
+        if (type_primitive == GL_POINTS)
+            glDrawArrays(GL_POINTS, 0, area);
+        else
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, (void *)0);
+    } else {
+        glDrawArrays(type_primitive, 0, 6 * area);
+    }
 
-    glDrawArrays(type_primitive, 0, 6 * area);
+    // A tarefa só reescreve o buffer depois que a GPU terminar de lê-lo
+    if (sequence != NULL && persistentMap) {
+        FrameSlot &slot = frameSlots[shownSlot];
+        if (slot.fence != 0)
+            glDeleteSync(slot.fence);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
 
     glutSwapBuffers();
+
+    // Na reprodução, cada quadro é medido até a GPU terminar
+    if (replayEvents != NULL) {
+        glFinish();
+        auto frameEnd = chrono::steady_clock::now();
+        frameTimes.push_back({chrono::duration<double, milli>(frameEnd - sessionStart).count(),
+                              chrono::duration<double, milli>(frameEnd - frameStart).count(), replayNext});
+    }
+
+    // O intervalo conta do início do quadro, como o vsync
+    lastFrame = frameStart;
+    double draw = chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count();
+    countFrame(renderStats, draw, wait);
+    countFrame(renderTotal, draw, wait);
+
+    // A animação já mostra suas medidas
+    if (!renderStatsScheduled && sequence == NULL) {
+        renderStatsScheduled = true;
+        glutTimerFunc(1000, showRenderStats, 0);
+    }
 }
 
 // Ajusta o tamanho da tela caso necessário
 void reshape(int width, int height) {
+    recordInput(CG_INPUT_RESHAPE, 0, width, height);
     win_width = width;
     win_height = height;
     glViewport(0, 0, width, height);
-    glutPostRedisplay();
+    requestRedraw(false);
 }
 
 void keyboardScale(unsigned char key) {
@@ -163,8 +633,91 @@ void keyboardRotation(unsigned char key) {
     }
 }
 
+// Passo das teclas que movem níveis e limites (5 em imagens de 8 bits)
+int intensityStep() {
+    return max(1, imageMaxval / 51);
+}
+
+// Gera a textura do mapa de cores atual (cinza, quente ou arco-íris)
+void loadColorMap() {
+    unsigned char lut[LUT_SIZE][4];
+    for (int i = 0; i < LUT_SIZE; i++) {
+        float t = i / (float)(LUT_SIZE - 1);
+        float r = t, g = t, b = t;
+        if (colorMap == 1) {
+            r = 3 * t;
+            g = 3 * t - 1;
+            b = 3 * t - 2;
+        } else if (colorMap == 2) {
+            r = 1.5f - fabsf(4 * t - 3);
+            g = 1.5f - fabsf(4 * t - 2);
+            b = 1.5f - fabsf(4 * t - 1);
+        }
+        lut[i][0] = (unsigned char)(255 * min(1.0f, max(0.0f, r)) + 0.5f);
+        lut[i][1] = (unsigned char)(255 * min(1.0f, max(0.0f, g)) + 0.5f);
+        lut[i][2] = (unsigned char)(255 * min(1.0f, max(0.0f, b)) + 0.5f);
+        lut[i][3] = 255;
+    }
+    glBindTexture(GL_TEXTURE_1D, lutTexture);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, LUT_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, lut);
+}
+
+// Cria a textura do mapa de cores (unidade 0) e aplica a janela de -W
+void initColorMap() {
+    glGenTextures(1, &lutTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_1D, lutTexture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    loadColorMap();
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "colorMap"), 0);
+
+    if (windowArg[0] >= 0 && windowArg[1] > windowArg[0]) {
+        windowLow = windowArg[0] / imageMaxval;
+        windowHigh = windowArg[1] / imageMaxval;
+    }
+}
+
+// Estreita ou alarga a janela ('-', '='), move o nível (',', '.') ou volta
+// à faixa inteira ('0')
+void moveWindow(unsigned char key) {
+    float level = (windowLow + windowHigh) / 2;
+    float width = windowHigh - windowLow;
+    float minWidth = 1.0f / imageMaxval;
+
+    switch (key) {
+        case '-':
+            width = max(minWidth, width * 0.8f);
+            break;
+        case '=':
+            width = min(2.0f, width * 1.25f);
+            break;
+        case ',':
+            level -= 0.02f;
+            break;
+        case '.':
+            level += 0.02f;
+            break;
+        case '0':
+            level = 0.5f;
+            width = 1.0f;
+            break;
+    }
+    windowLow = level - width / 2;
+    windowHigh = level + width / 2;
+}
+
+// Mostra a janela em unidades da imagem e o mapa de cores
+void showWindow() {
+    cout << "Janela: " << windowLow * imageMaxval << "-" << windowHigh * imageMaxval << " de " << imageMaxval
+         << ", mapa " << colorMapNames[colorMap] << endl;
+}
+
 // Faz a leitura das teclas do teclado
 void keyboard(unsigned char key, int x, int y) {
+    recordInput(CG_INPUT_KEY, key, 0, 0);
     switch (key) {
         case 'q':
             exit(0);
@@ -189,6 +742,57 @@ void keyboard(unsigned char key, int x, int y) {
             mode = SCALE;
             glutSetWindowTitle("Scale mode");
             break;
+        case ' ':
+            // Pausa ou continua a animação
+            paused = !paused;
+            break;
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+            if (isolines && (key == '[' || key == ']')) {
+                // Desloca todos os níveis das isolinhas
+                for (float &level : isoLevels)
+                    level += (key == '[') ? -intensityStep() : intensityStep();
+                rebuildIsolines();
+            } else if (pointCloud) {
+                // Move os limites da janela de intensidade da nuvem
+                int step = (key == '[' || key == '{') ? -intensityStep() : intensityStep();
+                int &bound = (key == '[' || key == ']') ? pointFilter.low : pointFilter.high;
+                bound = min(imageMaxval, max(0, bound + step));
+                rebuildPoints();
+            }
+            break;
+        case 'c':
+            // Próximo mapa de cores: só a textura muda
+            colorMap = (colorMap + 1) % (sizeof(colorMapNames) / sizeof(colorMapNames[0]));
+            loadColorMap();
+            contentDirty = true;
+            showWindow();
+            break;
+        case '-':
+        case '=':
+        case ',':
+        case '.':
+        case '0':
+            // Janela de intensidade: largura, nível ou padrão (só uniforms)
+            moveWindow(key);
+            showWindow();
+            break;
+        case 'x': {
+            // Exporta a malha como está na tela
+            if (sequence != NULL || pointCloud || isolines) {
+                cout << "Exportação disponível só para malhas" << endl;
+                break;
+            }
+            if (!slots.empty()) {
+                cout << "Exportação disponível só com uma imagem" << endl;
+                break;
+            }
+            glm::mat4 M = modelMatrix();
+            exportMesh(exportName, glm::value_ptr(M));
+            break;
+        }
         // faz o mapeamento das teclas de acordo com o modo atual escolhido
         default:
             switch (mode) {
@@ -204,11 +808,41 @@ void keyboard(unsigned char key, int x, int y) {
             }
     }
 
-    glutPostRedisplay();
+    // Teclas que não mudam a tela (ou repetidas antes do próximo quadro)
+    // não geram quadros a mais
+    requestRedraw(false);
+}
+
+// Tamanho em bytes dos vértices da malha atual
+size_t vertexBytes() {
+    if (pointCloud)
+        return sizeof(cgFlatVertex) * pointCount;
+    if (isolines)
+        return sizeof(cgFlatVertex) * lineVertexCount;
+    if (heightMode)
+        return sizeof(cgHeightVertex) * (size_t)area;
+    return sizeof(cgFlatVertex) * CG_MESH_FLAT_VERTICES * (size_t)area;
+}
+
+// Descreve os atributos do VBO ligado no VAO ligado
+void vertexAttributes() {
+    if (heightMode) {
+        // Posição em floats e normal 10:10:10:2 normalizada (16 bytes)
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(cgHeightVertex), (void *)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(cgHeightVertex), (void *)offsetof(cgHeightVertex, normal));
+        glEnableVertexAttribArray(1);
+    } else {
+        // Posição em floats e intensidade uint16 normalizada (12 bytes)
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(cgFlatVertex), (void *)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(cgFlatVertex), (void *)offsetof(cgFlatVertex, value));
+        glEnableVertexAttribArray(1);
+    }
 }
 
 // Inicializa o vertex para renderização
-void initData(float *vertices) {
+void initData(void *vertices) {
     // Vertex array.
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
@@ -216,13 +850,16 @@ void initData(float *vertices) {
     // Vertex buffer
     glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * area * 36, vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertexBytes(), vertices, GL_STATIC_DRAW);
 
     // Set attributes.
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    vertexAttributes();
+    if (heightMode) {
+        // Index buffer (fica associado ao VAO)
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indexCount, indices, GL_STATIC_DRAW);
+    }
 
     // Unbind Vertex Array Object.
     glBindVertexArray(0);
@@ -231,78 +868,1067 @@ void initData(float *vertices) {
 // Cria o programa e inicializa os shaders
 void initShaders() {
     // Request a program and shader slots from GPU
-    program = createShaderProgram(vertex_code, fragment_code);
+    auto start = chrono::steady_clock::now();
+    program = shaderProgram(heightMode ? "height" : "flat");
+    cout << "Shaders: " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+}
+
+// Aplica os filtros à imagem lida
+cgMat2i prepareImage(cgMat2i img) {
+    img = cgApplyFilters(img, filters);
+
+    // Converte para o layout de memória escolhido
+    if (img != NULL && layout != CG_LAYOUT_ROW_MAJOR) {
+        cgMat2i converted = cgConvertLayout2i(img, layout);
+        cgFreeMat2i(img);
+        img = converted;
+    }
+    return img;
 }
 
-// Normaliza o eixo Y
-float mapRow2Y(int r, int h) {
-    return (((h - 1.0f - r) / (h - 1.0f)) * 2.0f - 1.0f);
+// Lê a imagem (PGM ou formato em blocos comprimido) e aplica os filtros
+cgMat2i loadImage(const char *fileName) {
+    return prepareImage(cgIsTiledImage(fileName) ? cgReadTiledImage(fileName) : cgReadPGMImage(fileName));
+}
+
+// Envia a tabela de posições das imagens: uma grade centralizada com
+// colunas e linhas iguais (ou quase), com escala uniforme para não alterar
+// as normais
+void initImageTable() {
+    vector<glm::mat4> place(MAX_IMAGES, glm::mat4(1.0f));
+    int count = slots.size();
+    if (count > 1) {
+        int cols = (int)ceil(sqrt((double)count));
+        int rows = (count + cols - 1) / cols;
+        float size = 1.0f / max(cols, rows);
+        for (int i = 0; i < count; i++) {
+            float x = size * (2 * (i % cols) + 1 - cols);
+            float y = size * (rows - 2 * (i / cols) - 1);
+            place[i] = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f)), glm::vec3(size, size, size));
+        }
+    }
+
+    glGenBuffers(1, &UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * MAX_IMAGES, glm::value_ptr(place[0]), GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, UBO);
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Images"), 0);
+
+    // Com uma imagem o atributo fica desligado e vale 0
+    glBindVertexArray(VAO);
+    glVertexAttrib1f(2, 0.0f);
+    glBindVertexArray(0);
+}
+
+// Lê uma das várias imagens e gera sua malha (tarefa do pool)
+void loadSlot(void *arg) {
+    ImageSlot *slot = (ImageSlot *)arg;
+    slot->image = loadImage(slot->name);
+    if (slot->image == NULL)
+        return;
+
+    size_t area = (size_t)slot->image->height * slot->image->width;
+    if (heightMode) {
+        slot->vertices = cgBuildHeightMesh(slot->image, NULL, heightScale);
+        slot->indices = cgBuildHeightIndices(slot->image->height, slot->image->width, &slot->indexCount);
+        slot->vertexCount = area;
+    } else {
+        slot->vertices = cgBuildFlatMesh(slot->image, NULL);
+        slot->vertexCount = area * 6;
+    }
+}
+
+// Lê as imagens em paralelo e coloca todas as malhas em um único VBO (e
+// EBO), com um comando de desenho indireto por imagem
+void initImages(char **names, int count) {
+    if (count > MAX_IMAGES) {
+        cout << "Usando só as primeiras " << MAX_IMAGES << " imagens" << endl;
+        count = MAX_IMAGES;
+    }
+
+    vector<ImageSlot> loaded(count);
+    cgTaskGroup group;
+    cgTaskGroupInit(&group);
+    for (int i = 0; i < count; i++) {
+        memset(&loaded[i], 0, sizeof(ImageSlot));
+        loaded[i].name = names[i];
+        cgTaskGroupRun(&group, loadSlot, &loaded[i]);
+    }
+    cgTaskGroupWait(&group);
+
+    // Descarta as que falharam
+    size_t vertexSize = heightMode ? sizeof(cgHeightVertex) : sizeof(cgFlatVertex);
+    size_t vertexTotal = 0, indexTotal = 0;
+    for (int i = 0; i < count; i++) {
+        ImageSlot &slot = loaded[i];
+        if (slot.vertices == NULL || (heightMode && slot.indices == NULL)) {
+            cerr << "Não foi possível carregar " << slot.name << endl;
+            if (slot.image != NULL)
+                cgFreeMat2i(slot.image);
+            cgPoolFree(slot.vertices);
+            cgPoolFree(slot.indices);
+            continue;
+        }
+
+        slot.baseVertex = vertexTotal;
+        vertexTotal += slot.vertexCount;
+
+        // Imagens do mesmo tamanho compartilham os índices
+        bool shared = false;
+        for (size_t k = 0; k < slots.size() && heightMode; k++) {
+            if (slots[k].image->height == slot.image->height && slots[k].image->width == slot.image->width) {
+                slot.firstIndex = slots[k].firstIndex;
+                cgPoolFree(slot.indices);
+                slot.indices = NULL;
+                shared = true;
+                break;
+            }
+        }
+        if (heightMode && !shared) {
+            slot.firstIndex = indexTotal;
+            indexTotal += slot.indexCount;
+        }
+        slots.push_back(slot);
+    }
+    if (slots.empty()) {
+        cerr << "Nenhuma imagem carregada" << endl;
+        exit(1);
+    }
+    imageMaxval = slots[0].image->maxval;
+
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+
+    // Vertex buffer com todas as malhas, enviadas uma a uma
+    glGenBuffers(1, &VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertexSize * vertexTotal, NULL, GL_STATIC_DRAW);
+    for (ImageSlot &slot : slots) {
+        glBufferSubData(GL_ARRAY_BUFFER, vertexSize * slot.baseVertex, vertexSize * slot.vertexCount, slot.vertices);
+        cgPoolFree(slot.vertices);
+        slot.vertices = NULL;
+    }
+
+    vertexAttributes();
+    if (heightMode) {
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indexTotal, NULL, GL_STATIC_DRAW);
+        for (ImageSlot &slot : slots) {
+            if (slot.indices == NULL)
+                continue;
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * slot.firstIndex, sizeof(uint32_t) * slot.indexCount, slot.indices);
+            cgPoolFree(slot.indices);
+            slot.indices = NULL;
+        }
+    }
+
+    // Desenho indireto: o baseInstance de cada comando escolhe a linha da
+    // tabela pelo atributo por instância
+    multiDraw = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+    if (multiDraw) {
+        vector<float> ids(slots.size());
+        vector<DrawArraysCommand> arrays(slots.size());
+        vector<DrawElementsCommand> elements(slots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            ids[i] = i;
+            arrays[i] = {(GLuint)slots[i].vertexCount, 1, (GLuint)slots[i].baseVertex, (GLuint)i};
+            elements[i] = {(GLuint)slots[i].indexCount, 1, slots[i].firstIndex, slots[i].baseVertex, (GLuint)i};
+        }
+
+        glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * ids.size(), ids.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)0);
+        glVertexAttribDivisor(2, 1);
+        glEnableVertexAttribArray(2);
+
+        elementsCommandOffset = sizeof(DrawArraysCommand) * arrays.size();
+        glGenBuffers(1, &IBO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, IBO);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, elementsCommandOffset + sizeof(DrawElementsCommand) * elements.size(), NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, elementsCommandOffset, arrays.data());
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, elementsCommandOffset, sizeof(DrawElementsCommand) * elements.size(), elements.data());
+    }
+
+    glBindVertexArray(0);
+
+    cout << slots.size() << " imagens, " << (multiDraw ? "1 chamada de desenho" : "uma chamada por imagem") << endl;
 }
 
-// Normaliza o eixo X
-float mapColumn2X(int c, int w) {
-    return ((c / (w - 1.0f)) * 2.0f - 1.0f);
+// Mede os filtros e a redução 2x2 (pirâmide até 1 pixel) em cada layout
+void runBenchmark(const char *fileName) {
+    const char *names[] = {"row-major", "tiled", "morton"};
+    const int repeat = 5;
+
+    cgMat2i img = cgIsTiledImage(fileName) ? cgReadTiledImage(fileName) : cgReadPGMImage(fileName);
+    if (img == NULL)
+        return;
+
+    cout << "Imagem " << img->width << "x" << img->height << ", " << cgJobsThreadCount() << " threads" << endl;
+    for (int l = CG_LAYOUT_ROW_MAJOR; l <= CG_LAYOUT_MORTON; l++) {
+        cgMat2i src = cgConvertLayout2i(img, l);
+        cgMat2i dst = cgAllocateMat2iLayout(src->height, src->width, l);
+        double lod = 1e30, gauss = 1e30, mesh = 1e30, height = 1e30;
+        void *vertices = cgPoolAlloc(sizeof(cgFlatVertex) * CG_MESH_FLAT_VERTICES * (size_t)src->width * src->height);
+
+        for (int k = 0; k < repeat; k++) {
+            // Pirâmide de níveis de detalhe
+            auto t0 = chrono::steady_clock::now();
+            cgMat2i level = src;
+            while (level->height > 1 && level->width > 1) {
+                cgMat2i half = cgAllocateMat2iLayout(level->height / 2, level->width / 2, l);
+                cgDownsample2x2i(level, half);
+                if (level != src)
+                    cgFreeMat2i(level);
+                level = half;
+            }
+            cgFreeMat2i(level);
+
+            // Filtro gaussiano
+            auto t1 = chrono::steady_clock::now();
+            cgGaussianBlur2i(src, dst, 2.0f);
+
+            // Malha
+            auto t2 = chrono::steady_clock::now();
+            cgBuildFlatMesh(src, (cgFlatVertex *)vertices);
+
+            // Relevo (vértices e normais)
+            auto t3 = chrono::steady_clock::now();
+            cgBuildHeightMesh(src, (cgHeightVertex *)vertices, heightScale);
+            auto t4 = chrono::steady_clock::now();
+
+            lod = min(lod, chrono::duration<double, milli>(t1 - t0).count());
+            gauss = min(gauss, chrono::duration<double, milli>(t2 - t1).count());
+            mesh = min(mesh, chrono::duration<double, milli>(t3 - t2).count());
+            height = min(height, chrono::duration<double, milli>(t4 - t3).count());
+        }
+
+        cout << names[l] << ": lod " << lod << " ms, gauss " << gauss << " ms, mesh " << mesh << " ms, height " << height << " ms" << endl;
+        cgPoolFree(vertices);
+        cgFreeMat2i(src);
+        cgFreeMat2i(dst);
+    }
+    cgFreeMat2i(img);
 }
 
-// Adiciona um vértice ao conjunto
-void addVertice(int j, int i, float color) {
-    // Adiciona todas as informações do vertice
-    vertices[current++] = mapColumn2X(j, wwidth + 1);
-    vertices[current++] = mapRow2Y(i, hheight + 1);
-    vertices[current++] = 0.0f;
-    for (int h = 0; h < 3; h++)
-        vertices[current++] = color;
+// Gera a malha da imagem atual no modo escolhido
+void buildMesh() {
+    if (isolines) {
+        auto start = chrono::steady_clock::now();
+        cgContour contour = cgExtractContours(image, isoLevels.data(), isoLevels.size());
+        if (contour == NULL)
+            return;
+        vertices = cgBuildContourLines(contour, isoLevels.data(), &lineVertexCount);
+        cout << "Isolinhas: " << contour->count << " curvas, " << lineVertexCount / 2 << " segmentos ("
+             << 100.0 * vertexBytes() / (sizeof(cgFlatVertex) * CG_MESH_FLAT_VERTICES * area) << "% da malha), "
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+        cgFreeContour(contour);
+    } else if (pointCloud) {
+        vertices = cgBuildPointCloud(image, &pointFilter, &pointCount);
+        pointCapacity = pointCount;
+    } else if (heightMode) {
+        vertices = cgBuildHeightMesh(image, NULL, heightScale);
+        indices = cgBuildHeightIndices(hheight, wwidth, &indexCount);
+    } else {
+        vertices = cgBuildFlatMesh(image, NULL);
+    }
 }
 
 void readImage(char *fileName) {
     // Lê a imagem
-    cgMat2i img = cgReadPGMImage(fileName);
+    cgMat2i img = loadImage(fileName);
+    if (img == NULL) {
+        cerr << "Não foi possível ler " << fileName << endl;
+        exit(1);
+    }
+    image = img;
     wwidth = img->width;
     hheight = img->height;
     area = wwidth * hheight;
+    imageMaxval = img->maxval;
 
     // Cria os vértices com base nas informações da imagem
-    vertices = (float *)malloc((36 * area) * sizeof(float));
-    for (int i = 0; i < img->height; i++)
-        for (int j = 0; j < img->width; j++) {
-            float color = img->val[i][j] / 255.0;
-
-            // Primeiro triângulo
-            addVertice(j, i, color);
-            addVertice(j, i + 1, color);
-            addVertice(j + 1, i, color);
-
-            // Segundo triângulo
-            addVertice(j, i + 1, color);
-            addVertice(j + 1, i + 1, color);
-            addVertice(j + 1, i, color);
+    buildMesh();
+    if (vertices == NULL) {
+        cerr << "Não foi possível gerar a malha de " << fileName << endl;
+        exit(1);
+    }
+}
+
+// Tenta carregar imagem e malha do cache; retorna false se não houver
+bool loadCachedImage(const char *fileName, const cgMeshKey *key) {
+    char *cacheName = cgMeshCachePath(fileName);
+    if (cacheName == NULL)
+        return false;
+
+    meshCache = cgOpenMeshCache(cacheName, fileName, key);
+    free(cacheName);
+    if (meshCache == NULL)
+        return false;
+
+    wwidth = meshCache->width;
+    hheight = meshCache->height;
+    area = wwidth * hheight;
+    size_t expectedIndices = heightMode ? (size_t)(hheight - 1) * (wwidth - 1) * 6 : 0;
+    if (meshCache->vertexBytes != vertexBytes() || meshCache->indexCount != expectedIndices) {
+        cgCloseMeshCache(meshCache);
+        meshCache = NULL;
+        return false;
+    }
+
+    // A imagem residente é copiada para fora do mapeamento; sem memória
+    // para ela, a imagem é lida normalmente
+    cgMat2i copy = cgAllocateMat2i(hheight, wwidth);
+    if (copy != NULL) {
+        memcpy(copy->data, meshCache->pixels, (size_t)area * sizeof(int));
+        copy->maxval = meshCache->maxval;
+        if (layout != CG_LAYOUT_ROW_MAJOR) {
+            cgMat2i converted = cgConvertLayout2i(copy, layout);
+            cgFreeMat2i(copy);
+            copy = converted;
+        }
+    }
+    if (copy == NULL) {
+        cgCloseMeshCache(meshCache);
+        meshCache = NULL;
+        return false;
+    }
+    image = copy;
+    imageMaxval = image->maxval;
+
+    // Os vértices e índices são usados direto do mapeamento
+    vertices = meshCache->vertices;
+    indices = meshCache->indices;
+    indexCount = meshCache->indexCount;
+
+    return true;
+}
+
+// Salva imagem e malha no cache para a próxima execução
+void storeCachedImage(const char *fileName, const cgMeshKey *key) {
+    char *cacheName = cgMeshCachePath(fileName);
+    if (cacheName == NULL)
+        return;
+
+    cgWriteMeshCache(cacheName, fileName, key, image, vertices, vertexBytes(), indices, indexCount);
+    free(cacheName);
+}
+
+// Libera os vértices (alocados ou mapeados do cache)
+void releaseVertices() {
+    if (meshCache != NULL) {
+        cgCloseMeshCache(meshCache);
+        meshCache = NULL;
+    } else {
+        cgPoolFree(vertices);
+        cgPoolFree(indices);
+    }
+    vertices = NULL;
+    indices = NULL;
+    indexCount = 0;
+}
+
+// Refaz a nuvem de pontos a partir da imagem residente (sem ler nem filtrar
+// de novo) e envia só os pontos que restaram; o buffer só cresce
+void rebuildPoints() {
+    auto start = chrono::steady_clock::now();
+
+    size_t count;
+    cgFlatVertex *points = cgBuildPointCloud(image, &pointFilter, &count);
+    if (points == NULL)
+        return;
+    cgPoolFree(vertices);
+    vertices = points;
+    pointCount = count;
+
+    auto built = chrono::steady_clock::now();
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    if (pointCount > pointCapacity) {
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes(), vertices, GL_STATIC_DRAW);
+        pointCapacity = pointCount;
+    } else {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes(), vertices);
+    }
+
+    auto done = chrono::steady_clock::now();
+    cout << "Pontos: " << pointCount << " (" << 100.0 * pointCount / area << "%), janela "
+         << pointFilter.low << "-" << pointFilter.high
+         << ", compactação " << chrono::duration_cast<chrono::microseconds>(built - start).count() << " us"
+         << ", envio " << vertexBytes() / 1024 << " KB em " << chrono::duration_cast<chrono::microseconds>(done - built).count() << " us" << endl;
+
+    requestRedraw(true);
+}
+
+// Refaz as isolinhas da imagem residente e envia o buffer inteiro, que já
+// é proporcional ao comprimento das curvas
+void rebuildIsolines() {
+    void *old = vertices;
+    size_t oldCount = lineVertexCount;
+    buildMesh();
+    if (vertices == NULL) {
+        vertices = old;
+        lineVertexCount = oldCount;
+        return;
+    }
+    cgPoolFree(old);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertexBytes(), vertices, GL_STATIC_DRAW);
+    requestRedraw(true);
+}
+
+// Junta os pedaços da arena de rascunho usados pela imagem anterior, para a
+// próxima caber em um só
+void resetScratch() {
+    cgArena scratch = cgScratchArena();
+    if (scratch != NULL)
+        cgResetArena(scratch);
+}
+
+// Recarrega a imagem, enviando para a GPU só os trechos alterados da malha
+void reloadImage(const char *fileName) {
+    auto start = chrono::steady_clock::now();
+    cgPoolStats before;
+    cgPoolGetStats(&before);
+
+    cgMat2i next = loadImage(fileName);
+    if (next == NULL)
+        return;
+
+    auto loaded = chrono::steady_clock::now();
+    bool rescaled = next->maxval != imageMaxval;
+    imageMaxval = next->maxval;
+
+    if (pointCloud) {
+        // A nuvem é refeita inteira; a compactação já é proporcional aos
+        // pontos que restam
+        cgFreeMat2i(image);
+        image = next;
+        wwidth = next->width;
+        hheight = next->height;
+        area = wwidth * hheight;
+        rebuildPoints();
+        resetScratch();
+        return;
+    }
+
+    if (isolines) {
+        cgFreeMat2i(image);
+        image = next;
+        wwidth = next->width;
+        hheight = next->height;
+        area = wwidth * hheight;
+        rebuildIsolines();
+        resetScratch();
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    if (next->height != hheight || next->width != wwidth || rescaled) {
+        // Tamanho ou faixa de intensidades mudou: refaz a malha inteira;
+        // com outro tamanho os blocos antigos não servem mais e voltam ao
+        // sistema
+        bool resized = next->height != hheight || next->width != wwidth;
+        cgFreeMat2i(image);
+        releaseVertices();
+        if (resized)
+            cgPoolTrim();
+        image = next;
+        wwidth = next->width;
+        hheight = next->height;
+        area = wwidth * hheight;
+        buildMesh();
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes(), vertices, GL_STATIC_DRAW);
+        if (heightMode) {
+            glBindVertexArray(VAO);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indexCount, indices, GL_STATIC_DRAW);
+            glBindVertexArray(0);
+        }
+        cout << "Reload: " << wwidth << "x" << hheight << " (full)";
+    } else if (heightMode) {
+        // Relevo: as normais dependem dos vizinhos, então os vértices são
+        // refeitos inteiros (em paralelo); os índices não mudam
+        cgFreeMat2i(image);
+        image = next;
+        cgBuildHeightMesh(image, (cgHeightVertex *)vertices, heightScale);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes(), vertices);
+        cout << "Reload: " << vertexBytes() << " bytes";
+    } else {
+        // Mesmo tamanho: compara e atualiza só os blocos alterados
+        cgDirtyRange *ranges;
+        int count = cgUpdateFlatMesh(image, next, (cgFlatVertex *)vertices, &ranges);
+        size_t bytes = 0;
+        for (int i = 0; i < count; i++) {
+            glBufferSubData(GL_ARRAY_BUFFER, ranges[i].offset, ranges[i].size, (char *)vertices + ranges[i].offset);
+            bytes += ranges[i].size;
+        }
+        cgPoolFree(ranges);
+        cgFreeMat2i(next);
+        cout << "Reload: " << count << " ranges, " << bytes << " bytes";
+    }
+
+    // Com o mesmo tamanho, imagem e malha reaproveitam os blocos do pool
+    auto done = chrono::steady_clock::now();
+    cgPoolStats after;
+    cgPoolGetStats(&after);
+    cout << ", load " << chrono::duration_cast<chrono::microseconds>(loaded - start).count() << " us"
+         << ", update " << chrono::duration_cast<chrono::microseconds>(done - loaded).count() << " us"
+         << ", " << after.systemAllocs - before.systemAllocs << " alocações do sistema" << endl;
+
+    resetScratch();
+    requestRedraw(true);
+}
+
+// Verifica periodicamente se o arquivo da imagem mudou
+void checkReload(int value) {
+    (void)value;
+    if (cgPollWatch(watch))
+        reloadImage(imageName);
+    glutTimerFunc(RELOAD_INTERVAL, checkReload, 0);
+}
+
+// Medidas da animação, mostradas a cada segundo
+int shownFrames = 0;
+int decodedFrames = 0;
+int skippedFrames = 0;
+double decodeTime = 0.0;
+double uploadTime = 0.0;
+chrono::steady_clock::time_point statsStart;
+chrono::steady_clock::time_point nextShow;
+
+// Gera a malha de um quadro no buffer do slot (mapeado ou na CPU)
+bool buildFrame(FrameSlot *slot, cgMat2i img) {
+    if (img->height != hheight || img->width != wwidth)
+        return false;
+    void *dst = slot->mapped != NULL ? slot->mapped : slot->staging;
+    if (heightMode)
+        return cgBuildHeightMesh(img, (cgHeightVertex *)dst, heightScale) != NULL;
+    return cgBuildFlatMesh(img, (cgFlatVertex *)dst) != NULL;
+}
+
+// Lê, filtra e gera a malha de um quadro (tarefa do pool)
+void decodeFrame(void *arg) {
+    FrameSlot *slot = (FrameSlot *)arg;
+    auto start = chrono::steady_clock::now();
+    cgArena scratch = cgScratchArena();
+    size_t mark = scratch != NULL ? cgArenaMark(scratch) : 0;
+
+    cgMat2i img = prepareImage(cgReadSequenceFrame(sequence, slot->frame));
+    slot->ok = img != NULL && buildFrame(slot, img);
+    if (img != NULL)
+        cgFreeMat2i(img);
+
+    // Quadro rodado por uma thread que espera dentro de outra tarefa só
+    // devolve a sua parte da arena
+    if (scratch != NULL && mark == 0)
+        cgResetArena(scratch);
+    else if (scratch != NULL)
+        cgArenaRewind(scratch, mark);
+
+    slot->decodeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Coloca um slot pronto na tela; sem mapeamento persistente o buffer é
+// órfão antes do envio, para não esperar a GPU soltar o anterior
+void showSlot(int s) {
+    FrameSlot &slot = frameSlots[s];
+    if (!persistentMap) {
+        auto start = chrono::steady_clock::now();
+        glBindBuffer(GL_ARRAY_BUFFER, slot.VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes(), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes(), slot.staging);
+        uploadTime += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    if (shownSlot >= 0)
+        frameSlots[shownSlot].state = SLOT_FREE;
+    slot.state = SLOT_SHOWN;
+    shownSlot = s;
+    shownFrames++;
+    requestRedraw(true);
+}
+
+// Slot livre cujo buffer a GPU já terminou de ler (sem esperar)
+int freeSlot() {
+    for (int s = 0; s < PLAYBACK_SLOTS; s++) {
+        FrameSlot &slot = frameSlots[s];
+        if (slot.state != SLOT_FREE)
+            continue;
+        if (slot.fence != 0) {
+            if (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+                continue;
+            glDeleteSync(slot.fence);
+            slot.fence = 0;
+        }
+        return s;
+    }
+    return -1;
+}
+
+// Slot pronto mais antigo
+int readySlot() {
+    int ready = -1;
+    for (int s = 0; s < PLAYBACK_SLOTS; s++)
+        if (frameSlots[s].state == SLOT_READY && (ready < 0 || frameSlots[s].serial < frameSlots[ready].serial))
+            ready = s;
+    return ready;
+}
+
+// Avança a animação: recolhe o quadro decodificado, mostra o próximo no
+// ritmo pedido e começa a decodificar outro em um buffer livre
+void playbackIdle() {
+    auto now = chrono::steady_clock::now();
+    bool busy = false;
+
+    if (decodingSlot >= 0 && __atomic_load_n(&decodeGroup.pending, __ATOMIC_SEQ_CST) == 0) {
+        FrameSlot &slot = frameSlots[decodingSlot];
+        if (slot.ok) {
+            slot.state = SLOT_READY;
+            decodeTime += slot.decodeMs;
+            decodedFrames++;
+        } else {
+            // Quadro ilegível ou de outro tamanho
+            slot.state = SLOT_FREE;
+            skippedFrames++;
         }
+        decodingSlot = -1;
+        busy = true;
+    }
+
+    int ready = readySlot();
+    if (ready >= 0 && !paused && now >= nextShow) {
+        showSlot(ready);
+        if (playbackRate > 0) {
+            nextShow += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / playbackRate));
+            if (nextShow < now)
+                nextShow = now;
+        }
+        busy = true;
+    }
+
+    int s = (decodingSlot < 0 && !paused && cgSequenceLength(sequence) > 1) ? freeSlot() : -1;
+    if (s >= 0) {
+        FrameSlot &slot = frameSlots[s];
+        slot.state = SLOT_DECODING;
+        slot.frame = nextFrame;
+        slot.serial = nextSerial++;
+        nextFrame = (nextFrame + 1) % cgSequenceLength(sequence);
+        decodingSlot = s;
+        cgTaskGroupRun(&decodeGroup, decodeFrame, &slot);
+        busy = true;
+    }
+
+    double elapsed = chrono::duration<double>(now - statsStart).count();
+    if (elapsed >= 1.0 && cgSequenceLength(sequence) > 1) {
+        cout << "Animação: " << shownFrames / elapsed << " quadros/s, decodificação "
+             << (decodedFrames > 0 ? decodeTime / decodedFrames : 0.0) << " ms";
+        if (!persistentMap)
+            cout << ", envio " << (shownFrames > 0 ? uploadTime / shownFrames : 0.0) << " ms";
+        if (skippedFrames > 0)
+            cout << ", " << skippedFrames << " pulados";
+        cout << endl;
+        shownFrames = decodedFrames = skippedFrames = 0;
+        decodeTime = uploadTime = 0.0;
+        statsStart = now;
+    }
+
+    // Nada a fazer: ajuda a decodificação (todo o trabalho, se o pool não
+    // tiver outras threads) ou não ocupa a CPU à toa
+    if (!busy && !(decodingSlot >= 0 && cgJobsRunPending()))
+        this_thread::sleep_for(chrono::microseconds(500));
+}
+
+// Abre a sequência e cria os buffers da animação; o primeiro quadro define
+// o tamanho da malha
+void initPlayback(const char *name) {
+    sequence = cgOpenSequence(name);
+    if (sequence == NULL) {
+        cerr << "Não foi possível abrir a sequência " << name << endl;
+        exit(1);
+    }
+
+    cgMat2i first = prepareImage(cgReadSequenceFrame(sequence, 0));
+    if (first == NULL) {
+        cerr << "Não foi possível ler o primeiro quadro de " << name << endl;
+        exit(1);
+    }
+    wwidth = first->width;
+    hheight = first->height;
+    area = wwidth * hheight;
+    imageMaxval = first->maxval;
+
+    if (heightMode) {
+        indices = cgBuildHeightIndices(hheight, wwidth, &indexCount);
+        if (indices == NULL) {
+            cerr << "Não foi possível gerar a malha de " << name << endl;
+            exit(1);
+        }
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indexCount, indices, GL_STATIC_DRAW);
+    }
+
+    // Com mapeamento persistente a tarefa escreve direto na memória do
+    // buffer; sem ele, escreve em uma cópia enviada na hora de mostrar
+    persistentMap = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (int s = 0; s < PLAYBACK_SLOTS; s++) {
+        FrameSlot &slot = frameSlots[s];
+        memset(&slot, 0, sizeof(FrameSlot));
+
+        glGenVertexArrays(1, &slot.VAO);
+        glBindVertexArray(slot.VAO);
+        glGenBuffers(1, &slot.VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, slot.VBO);
+        if (persistentMap) {
+            glBufferStorage(GL_ARRAY_BUFFER, vertexBytes(), NULL, flags);
+            slot.mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertexBytes(), flags);
+        } else {
+            glBufferData(GL_ARRAY_BUFFER, vertexBytes(), NULL, GL_STREAM_DRAW);
+            slot.staging = cgPoolAlloc(vertexBytes());
+        }
+        if (slot.mapped == NULL && slot.staging == NULL) {
+            cerr << "Não foi possível criar os buffers da animação" << endl;
+            exit(1);
+        }
+        vertexAttributes();
+        if (heightMode)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    }
+    glBindVertexArray(0);
+
+    if (!buildFrame(&frameSlots[0], first)) {
+        cerr << "Não foi possível gerar a malha de " << name << endl;
+        exit(1);
+    }
+    cgFreeMat2i(first);
+    showSlot(0);
+    nextFrame = 1 % cgSequenceLength(sequence);
+
+    cgTaskGroupInit(&decodeGroup);
+    statsStart = nextShow = chrono::steady_clock::now();
+    shownFrames = 0;
+
+    cout << cgSequenceLength(sequence) << " quadros " << wwidth << "x" << hheight << ", "
+         << (persistentMap ? "mapeamento persistente" : "buffers órfãos") << endl;
+}
+
+// Grava o tempo de cada quadro da reprodução (LOG.frames.csv), mostra o
+// resumo e encerra
+void finishReplay() {
+    string csvName = string(replayName) + ".frames.csv";
+    FILE *fp = fopen(csvName.c_str(), "w");
+    if (fp != NULL) {
+        fprintf(fp, "frame,time_ms,draw_ms,events\n");
+        for (size_t i = 0; i < frameTimes.size(); i++)
+            fprintf(fp, "%zu,%.3f,%.3f,%d\n", i, frameTimes[i].time, frameTimes[i].draw, frameTimes[i].events);
+        fclose(fp);
+    }
+
+    vector<double> draw;
+    for (FrameTime &f : frameTimes)
+        draw.push_back(f.draw);
+    sort(draw.begin(), draw.end());
+    double total = frameTimes.empty() ? 0.0 : frameTimes.back().time;
+    cout << "Reprodução: " << replayCount << " eventos, " << draw.size() << " quadros em " << total << " ms" << endl;
+    if (!draw.empty())
+        cout << "Quadro (ms): média " << accumulate(draw.begin(), draw.end(), 0.0) / draw.size()
+             << ", p50 " << draw[draw.size() / 2] << ", p95 " << draw[draw.size() * 95 / 100]
+             << ", máx " << draw.back() << " (" << csvName << ")" << endl;
+    printRenderStats("Agendamento: ", renderTotal);
+    exit(0);
+}
+
+// Aplica os eventos gravados pelos mesmos caminhos da entrada interativa:
+// no tempo original, ou um por quadro no modo rápido
+void replayTick(int value) {
+    (void)value;
+    // O fim, e cada evento no modo rápido, esperam o quadro já pedido
+    if (redrawPending && (replayFast || replayNext >= replayCount)) {
+        glutTimerFunc(1, replayTick, 0);
+        return;
+    }
+    if (replayNext >= replayCount)
+        finishReplay();
+
+    uint64_t now = sessionTime();
+    while (replayNext < replayCount && (replayFast || replayEvents[replayNext].time <= now)) {
+        cgInputEvent &e = replayEvents[replayNext++];
+        if (e.type == CG_INPUT_KEY) {
+            if (e.key == 'q')
+                finishReplay();
+            keyboard(e.key, 0, 0);
+        } else {
+            glutReshapeWindow(e.width, e.height);
+        }
+        if (replayFast)
+            break;
+    }
+
+    // O fim espera o último quadro ser desenhado
+    unsigned delay = 0;
+    if (!replayFast && replayNext < replayCount)
+        delay = (replayEvents[replayNext].time - min(now, replayEvents[replayNext].time)) / 1000;
+    glutTimerFunc(delay, replayTick, 0);
+}
+
+// Converte várias imagens em malhas, prévias e estatísticas
+int runBatch(char **args, int count, const char *outDir, size_t memory, int previewSize) {
+    int total;
+    char **inputs = cgExpandBatchInputs(args, count, &total);
+    if (inputs == NULL)
+        return 1;
+    if (total == 0) {
+        cerr << "Nenhuma imagem encontrada" << endl;
+        cgFreeBatchInputs(inputs, total);
+        return 1;
+    }
+
+    cgBatchOptions opt;
+    opt.outDir = outDir;
+    opt.filters = filters;
+    opt.format = heightMode ? CG_MESH_FORMAT_HEIGHT : CG_MESH_FORMAT_FLAT;
+    opt.heightScale = heightScale;
+    opt.previewSize = previewSize;
+    opt.memoryBudget = memory;
+
+    cgBatchStats stats;
+    int ok = cgRunBatch(inputs, total, &opt, &stats);
+    cgFreeBatchInputs(inputs, total);
+
+    // Lote que nem começou (diretório de saída, memória) não tem relatório
+    if (stats.files == 0)
+        return 1;
+
+    cout << "Lote: " << stats.files << " arquivos, " << stats.failed << " falhas, "
+         << stats.seconds << " s, " << cgJobsThreadCount() << " threads" << endl;
+    cout << stats.files / stats.seconds << " arquivos/s, "
+         << stats.bytesIn / 1e6 / stats.seconds << " MB/s lidos, "
+         << stats.bytesOut / 1e6 / stats.seconds << " MB/s escritos" << endl;
+
+    cgPoolStats pool;
+    cgPoolGetStats(&pool);
+    cout << "Memória: " << pool.systemAllocs << " alocações do sistema, " << pool.reused << " blocos reaproveitados, "
+         << pool.hugeBytes / 1e6 << " MB em páginas grandes" << endl;
+
+    return ok ? 0 : 1;
+}
+
+// Mostra como usar o programa
+void usage(const char *name) {
+    cout << "Uso: " << name << " [-f filtros] [-l row|tiled|morton] [-H] [-B] [-o malha.ply|obj|stl] imagem..." << endl;
+    cout << "     " << name << " -I nível[,nível...] [-f filtros] [-l row|tiled|morton] imagem" << endl;
+    cout << "     " << name << " -P mín:máx[:passo[:fração]] [-f filtros] [-l row|tiled|morton] imagem" << endl;
+    cout << "     " << name << " -a [-r quadros/s] [-f filtros] [-H] sequência.pgm | \"quadro%03d.pgm\" | \"padrão\" | @lista" << endl;
+    cout << "     " << name << " [-g gravação.log | -G gravação.log [-s]] ... imagem" << endl;
+    cout << "     " << name << " [-W mín:máx] [-C cinza|quente|arco-íris] [-F quadros/s] ... imagem..." << endl;
+    cout << "     " << name << " -b saída [-f filtros] [-H] [-m MB] [-p lado] imagens... | \"padrão\" | @lista" << endl;
 }
 
 int main(int argc, char **argv) {
+    // Lê as opções da linha de comando
+    bool benchmark = false;
+    const char *outputName = NULL;
+    const char *batchDir = NULL;
+    size_t batchMemory = (size_t)CG_BATCH_MEMORY_MB << 20;
+    int previewSize = CG_BATCH_PREVIEW_SIZE;
+    bool animation = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:l:HBb:m:p:o:ar:P:I:g:G:sW:C:F:")) != -1) {
+        switch (opt) {
+            case 'f':
+                filters = optarg;
+                break;
+            case 'l':
+                if (strcmp(optarg, "tiled") == 0)
+                    layout = CG_LAYOUT_TILED;
+                else if (strcmp(optarg, "morton") == 0)
+                    layout = CG_LAYOUT_MORTON;
+                else
+                    layout = CG_LAYOUT_ROW_MAJOR;
+                break;
+            case 'H':
+                heightMode = true;
+                break;
+            case 'B':
+                benchmark = true;
+                break;
+            case 'b':
+                batchDir = optarg;
+                break;
+            case 'm':
+                batchMemory = (size_t)atol(optarg) << 20;
+                break;
+            case 'p':
+                previewSize = atoi(optarg);
+                break;
+            case 'o':
+                outputName = optarg;
+                break;
+            case 'a':
+                animation = true;
+                break;
+            case 'r':
+                playbackRate = atof(optarg);
+                break;
+            case 'g':
+                inputLog = cgCreateInputLog(optarg);
+                if (inputLog == NULL)
+                    return 1;
+                break;
+            case 'G':
+                replayName = optarg;
+                break;
+            case 's':
+                replayFast = true;
+                break;
+            case 'W':
+                // Janela inicial, em unidades da imagem (até o maxval)
+                if (sscanf(optarg, "%f:%f", &windowArg[0], &windowArg[1]) != 2 || windowArg[1] <= windowArg[0] || windowArg[0] < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'F':
+                frameRate = atof(optarg);
+                break;
+            case 'C':
+                colorMap = -1;
+                for (int m = 0; m < (int)(sizeof(colorMapNames) / sizeof(colorMapNames[0])); m++)
+                    if (strcmp(optarg, colorMapNames[m]) == 0)
+                        colorMap = m;
+                if (colorMap < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'I': {
+                // Níveis separados por vírgula
+                char *end = optarg;
+                isolines = true;
+                isoLevels.clear();
+                do {
+                    char *p = end + (*end == ',');
+                    isoLevels.push_back(strtof(p, &end));
+                    if (end == p) {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                } while (*end == ',');
+                break;
+            }
+            case 'P':
+                // Janela de intensidade, passo e fração da amostragem
+                pointCloud = true;
+                if (sscanf(optarg, "%d:%d:%d:%f", &pointFilter.low, &pointFilter.high, &pointFilter.stride, &pointFilter.fraction) < 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    imageName = argv[optind];
+
+    // A nuvem de pontos e as isolinhas usam o formato plano e valem só para
+    // uma imagem na tela
+    bool single = batchDir == NULL && outputName == NULL && !benchmark && !animation && argc - optind == 1;
+    isolines = isolines && single;
+    pointCloud = pointCloud && single && !isolines;
+    if (pointCloud || isolines)
+        heightMode = false;
+
+    // Modo em lote (sem janela)
+    if (batchDir != NULL)
+        return runBatch(argv + optind, argc - optind, batchDir, batchMemory, previewSize);
+
+    // Exporta a malha sem transformação (sem janela)
+    if (outputName != NULL) {
+        readImage(imageName);
+        return exportMesh(outputName, NULL) ? 0 : 1;
+    }
+
+    // Modo de medição (sem janela)
+    if (benchmark) {
+        runBenchmark(imageName);
+        return 0;
+    }
+
     // Inicializa o opengGL
     glutInit(&argc, argv);
     glutInitContextVersion(3, 3);
     glutInitContextProfile(GLUT_CORE_PROFILE);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
     glutInitWindowSize(win_width, win_height);
     glutCreateWindow(argv[0]);
     glutSetWindowTitle("Rotation mode");
     glewExperimental = GL_TRUE;
     glewInit();
+    glEnable(GL_DEPTH_TEST);
 
-    // Lê a imagem
-    readImage(argv[1]);
+    if (animation) {
+        // Sequência de quadros, sem cache nem observação do arquivo
+        initPlayback(imageName);
+    } else if (argc - optind > 1) {
+        // Várias imagens lado a lado
+        initImages(argv + optind, argc - optind);
+    } else {
+        // Lê a imagem (ou reaproveita a malha do cache); a escala do relevo
+        // entra na chave porque as normais dependem dela
+        cgMeshKey key;
+        string options = filters;
+        if (heightMode)
+            options += ";height=" + to_string(heightScale);
+        int format = heightMode ? CG_MESH_FORMAT_HEIGHT : CG_MESH_FORMAT_FLAT;
+        bool cacheable = !pointCloud && !isolines && cgMeshKeyFromFile(imageName, format, options.c_str(), &key) == CG_TRUE;
+        if (!cacheable || !loadCachedImage(imageName, &key)) {
+            readImage(imageName);
+            if (cacheable)
+                storeCachedImage(imageName, &key);
+        }
 
-    // Inicializa o vertex
-    initData(vertices);
+        // Inicializa o vertex
+        initData(vertices);
+    }
 
     // Inicicializa os shaders.
     initShaders();
+    initImageTable();
+    initColorMap();
+    initViewBuffer();
     glutReshapeFunc(reshape);
 
     // Desenha a malha triangular
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
+
+    // Observa o arquivo da imagem para recarregá-lo quando mudar
+    watch = (slots.empty() && sequence == NULL) ? cgOpenWatch(imageName) : NULL;
+    if (watch != NULL)
+        glutTimerFunc(RELOAD_INTERVAL, checkReload, 0);
+
+    if (sequence != NULL)
+        glutIdleFunc(playbackIdle);
+
+    // Reprodução de uma sessão gravada (a gravação fica desligada)
+    if (replayName != NULL) {
+        replayEvents = cgReadInputLog(replayName, &replayCount);
+        if (replayEvents == NULL)
+            return 1;
+        cgCloseInputLog(inputLog);
+        inputLog = NULL;
+        glutTimerFunc(0, replayTick, 0);
+    }
+    sessionStart = chrono::steady_clock::now();
+
     glutMainLoop();
 }